@@ -0,0 +1,762 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+#if defined(__linux__) && defined(__has_include) && !defined(CADDY65_NO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define useUring 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+static const char * const tempSuffix = ".caddy65.tmp";
+
+typedef enum {
+    openingSource,
+    readingSource,
+    creatingTemp,
+    writingTemp,
+    closingTemp,
+    renamingTemp,
+} step_t;
+
+typedef struct {
+    step_t step;
+    int fd;
+    size_t done;
+    mode_t mode;
+    char * temp;
+} progress_t;
+
+typedef struct {
+    batchFile_t * files;
+    progress_t * progress;
+    int numFiles;
+    int nextFile;
+    int failures;
+    pthread_mutex_t lock;
+    batchFormat_t format;
+    void * user;
+} batch_t;
+
+typedef struct {
+    batch_t * batch;
+    int worker;
+} worker_t;
+
+static int claimFile(batch_t * batch) {
+    pthread_mutex_lock(&batch->lock);
+    int i = batch->nextFile < batch->numFiles ? batch->nextFile++ : -1;
+    pthread_mutex_unlock(&batch->lock);
+    return i;
+}
+
+static void finishFile(batch_t * batch, int i, const char * failure, int error) {
+    batchFile_t * file = batch->files + i;
+    progress_t * progress = batch->progress + i;
+
+    if (failure) {
+        fprintf(stderr, "%s: %s: %s\n", failure, file->path, strerror(error));
+        file->failed = 1;
+
+        if (progress->temp && progress->step >= writingTemp) {
+            unlink(progress->temp);
+        }
+    }
+
+    if (file->failed) {
+        pthread_mutex_lock(&batch->lock);
+        ++batch->failures;
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    free(file->input);
+    free(file->output);
+    free(progress->temp);
+    file->input = file->output = progress->temp = NULL;
+}
+
+// returns nonzero if the file was finished without anything to write
+static int formatFile(batch_t * batch, int i, int worker) {
+    batchFile_t * file = batch->files + i;
+    progress_t * progress = batch->progress + i;
+
+    file->input[file->inputSize] = '\0';
+    batch->format(file, worker, batch->user);
+
+    free(file->input);
+    file->input = NULL;
+
+    if (file->failed || !file->output) {
+        finishFile(batch, i, NULL, 0);
+        return 1;
+    }
+
+    size_t len = strlen(file->path);
+    progress->temp = malloc(len + strlen(tempSuffix) + 1);
+
+    if (!progress->temp) {
+        finishFile(batch, i, "failed to create temporary file", ENOMEM);
+        return 1;
+    }
+
+    memcpy(progress->temp, file->path, len);
+    strcpy(progress->temp + len, tempSuffix);
+    return 0;
+}
+
+static void processBlocking(batch_t * batch, int i, int worker) {
+    batchFile_t * file = batch->files + i;
+    progress_t * progress = batch->progress + i;
+    struct stat st;
+
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        finishFile(batch, i, "failed to open source file", error);
+        return;
+    }
+
+    file->input = malloc(st.st_size + 1);
+    file->inputSize = 0;
+
+    while (file->input && file->inputSize < (size_t) st.st_size) {
+        ssize_t got = read(fd, file->input + file->inputSize, st.st_size - file->inputSize);
+        if (got <= 0) {
+            break;
+        }
+        file->inputSize += got;
+    }
+
+    int error = file->input ? errno : ENOMEM;
+    close(fd);
+
+    if (!file->input || file->inputSize < (size_t) st.st_size) {
+        finishFile(batch, i, "failed to read source file", error);
+        return;
+    }
+
+    if (formatFile(batch, i, worker)) {
+        return;
+    }
+
+    progress->step = creatingTemp;
+    fd = open(progress->temp, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+    if (fd < 0) {
+        finishFile(batch, i, "failed to create temporary file", errno);
+        return;
+    }
+
+    progress->step = writingTemp;
+
+    size_t done = 0;
+    while (done < file->outputSize) {
+        ssize_t put = write(fd, file->output + done, file->outputSize - done);
+        if (put <= 0) {
+            break;
+        }
+        done += put;
+    }
+
+    error = errno;
+    if (close(fd) && done == file->outputSize) {
+        done = 0;
+        error = errno;
+    }
+
+    if (done < file->outputSize) {
+        finishFile(batch, i, "failed to write temporary file", error);
+        return;
+    }
+
+    if (rename(progress->temp, file->path)) {
+        finishFile(batch, i, "failed to rename temporary file", errno);
+        return;
+    }
+
+    finishFile(batch, i, NULL, 0);
+}
+
+#ifdef useUring
+static const int filesInFlight = 32;
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned pending;
+    unsigned * sqHead;
+    unsigned * sqTail;
+    unsigned * sqMask;
+    unsigned * sqArray;
+    unsigned * cqHead;
+    unsigned * cqTail;
+    unsigned * cqMask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sq;
+    void * cq;
+    size_t sqSize;
+    size_t cqSize;
+    size_t sqesSize;
+} ring_t;
+
+static const unsigned requiredOps[] = {
+    IORING_OP_OPENAT,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_CLOSE,
+    IORING_OP_RENAMEAT,
+};
+
+static void closeRing(ring_t * ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+
+    if (ring->cq && ring->cq != ring->sq) {
+        munmap(ring->cq, ring->cqSize);
+    }
+
+    if (ring->sq) {
+        munmap(ring->sq, ring->sqSize);
+    }
+
+    close(ring->fd);
+}
+
+static int probeRing(ring_t * ring) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe * probe = calloc(1, size);
+
+    if (!probe || syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256)) {
+        free(probe);
+        return 0;
+    }
+
+    int supported = 1;
+
+    for (size_t i = 0; i < sizeof(requiredOps) / sizeof(requiredOps[0]); ++i) {
+        unsigned op = requiredOps[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            supported = 0;
+        }
+    }
+
+    free(probe);
+    return supported;
+}
+
+static int openRing(ring_t * ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(ring_t));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return 1;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP && ring->cqSize > ring->sqSize) {
+        ring->sqSize = ring->cqSize;
+    }
+
+    ring->sq = mmap(NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq == MAP_FAILED) {
+        ring->sq = NULL;
+        closeRing(ring);
+        return 1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq = ring->sq;
+    } else {
+        ring->cq = mmap(NULL, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq == MAP_FAILED) {
+            ring->cq = NULL;
+            closeRing(ring);
+            return 1;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        closeRing(ring);
+        return 1;
+    }
+
+    char * sq = ring->sq;
+    char * cq = ring->cq;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    if (!probeRing(ring)) {
+        closeRing(ring);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int enterRing(ring_t * ring, unsigned waitFor) {
+    while (ring->pending || waitFor) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, waitFor,
+            waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // the kernel is short of memory or completion space, so the caller reaps and tries again
+            if (errno == EAGAIN || errno == EBUSY) {
+                return 0;
+            }
+
+            return 1;
+        }
+
+        ring->pending -= submitted;
+        waitFor = 0;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe * queueOp(ring_t * ring, uint8_t opcode, int fd, uint64_t data) {
+    unsigned tail = *ring->sqTail;
+
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->entries) {
+        enterRing(ring, 0);
+    }
+
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe * sqe = ring->sqes + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = data;
+
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->pending;
+
+    return sqe;
+}
+
+// user data 0 marks closes of source files, whose results are not needed
+static void queueClose(ring_t * ring, int fd, uint64_t data) {
+    queueOp(ring, IORING_OP_CLOSE, fd, data);
+}
+
+static void queueTransfer(ring_t * ring, uint8_t opcode, int fd, char * buffer, size_t size, size_t offset, int i) {
+    struct io_uring_sqe * sqe = queueOp(ring, opcode, fd, i + 1);
+    sqe->addr = (uintptr_t) buffer;
+    sqe->len = size > 0x40000000 ? 0x40000000 : size;
+    sqe->off = offset;
+}
+
+static void queueOpen(ring_t * ring, const char * path, int flags, mode_t mode, int i) {
+    struct io_uring_sqe * sqe = queueOp(ring, IORING_OP_OPENAT, AT_FDCWD, i + 1);
+    sqe->addr = (uintptr_t) path;
+    sqe->open_flags = flags;
+    sqe->len = mode;
+}
+
+// advances a file to its next step, returning nonzero once it is finished
+static int advance(batch_t * batch, ring_t * ring, int i, int result, int worker) {
+    batchFile_t * file = batch->files + i;
+    progress_t * progress = batch->progress + i;
+
+    switch (progress->step) {
+        case openingSource: {
+            struct stat st;
+
+            if (result < 0) {
+                finishFile(batch, i, "failed to open source file", -result);
+                return 1;
+            }
+
+            progress->fd = result;
+
+            if (fstat(progress->fd, &st)) {
+                int error = errno;
+                queueClose(ring, progress->fd, 0);
+                finishFile(batch, i, "failed to open source file", error);
+                return 1;
+            }
+
+            progress->mode = st.st_mode & 07777;
+            file->input = malloc(st.st_size + 1);
+            file->inputSize = st.st_size;
+
+            if (!file->input) {
+                queueClose(ring, progress->fd, 0);
+                finishFile(batch, i, "failed to read source file", ENOMEM);
+                return 1;
+            }
+
+            progress->step = readingSource;
+            progress->done = 0;
+
+            if (file->inputSize) {
+                queueTransfer(ring, IORING_OP_READ, progress->fd, file->input, file->inputSize, 0, i);
+                return 0;
+            }
+
+            return advance(batch, ring, i, 0, worker);
+        }
+        case readingSource: {
+            if (result < 0) {
+                queueClose(ring, progress->fd, 0);
+                finishFile(batch, i, "failed to read source file", -result);
+                return 1;
+            }
+
+            progress->done += result;
+
+            if (result && progress->done < file->inputSize) {
+                queueTransfer(ring, IORING_OP_READ, progress->fd, file->input + progress->done,
+                    file->inputSize - progress->done, progress->done, i);
+                return 0;
+            }
+
+            queueClose(ring, progress->fd, 0);
+            file->inputSize = progress->done;
+
+            if (formatFile(batch, i, worker)) {
+                return 1;
+            }
+
+            progress->step = creatingTemp;
+            queueOpen(ring, progress->temp, O_WRONLY | O_CREAT | O_TRUNC, progress->mode, i);
+            return 0;
+        }
+        case creatingTemp: {
+            if (result < 0) {
+                finishFile(batch, i, "failed to create temporary file", -result);
+                return 1;
+            }
+
+            progress->fd = result;
+            progress->step = writingTemp;
+            progress->done = 0;
+
+            if (file->outputSize) {
+                queueTransfer(ring, IORING_OP_WRITE, progress->fd, file->output, file->outputSize, 0, i);
+                return 0;
+            }
+
+            return advance(batch, ring, i, 0, worker);
+        }
+        case writingTemp: {
+            if (result < 0 || (result == 0 && progress->done < file->outputSize)) {
+                queueClose(ring, progress->fd, 0);
+                finishFile(batch, i, "failed to write temporary file", result < 0 ? -result : EIO);
+                return 1;
+            }
+
+            progress->done += result;
+
+            if (progress->done < file->outputSize) {
+                queueTransfer(ring, IORING_OP_WRITE, progress->fd, file->output + progress->done,
+                    file->outputSize - progress->done, progress->done, i);
+                return 0;
+            }
+
+            progress->step = closingTemp;
+            queueClose(ring, progress->fd, i + 1);
+            return 0;
+        }
+        case closingTemp: {
+            if (result < 0) {
+                finishFile(batch, i, "failed to write temporary file", -result);
+                return 1;
+            }
+
+            progress->step = renamingTemp;
+            struct io_uring_sqe * sqe = queueOp(ring, IORING_OP_RENAMEAT, AT_FDCWD, i + 1);
+            sqe->addr = (uintptr_t) progress->temp;
+            sqe->addr2 = (uintptr_t) file->path;
+            sqe->len = AT_FDCWD;
+            return 0;
+        }
+        case renamingTemp: {
+            finishFile(batch, i, result < 0 ? "failed to rename temporary file" : NULL, -result);
+            return 1;
+        }
+    }
+
+    return 1;
+}
+
+// undoes a file's progress once it has no request left running, returning nonzero if it must be redone
+static int rewindFile(batch_t * batch, int i, int completed, int result) {
+    batchFile_t * file = batch->files + i;
+    progress_t * progress = batch->progress + i;
+
+    switch (progress->step) {
+        case openingSource:
+        case creatingTemp: {
+            if (completed && result >= 0) {
+                close(result);
+            }
+            break;
+        }
+        case readingSource:
+        case writingTemp: {
+            close(progress->fd);
+            break;
+        }
+        case closingTemp: {
+            if (!completed) {
+                close(progress->fd);
+            }
+            break;
+        }
+        case renamingTemp: {
+            if (completed) {
+                finishFile(batch, i, result < 0 ? "failed to rename temporary file" : NULL, -result);
+                return 0;
+            }
+            break;
+        }
+    }
+
+    if (progress->temp && progress->step >= creatingTemp) {
+        unlink(progress->temp);
+    }
+
+    free(file->input);
+    free(file->output);
+    free(progress->temp);
+    file->input = file->output = progress->temp = NULL;
+    progress->step = openingSource;
+    return 1;
+}
+
+/*
+ * Called once the ring has failed. Requests the kernel has already taken may
+ * still be using their buffers, so each file in flight is only rewound once
+ * its request has completed, and is then redone with blocking I/O.
+ */
+static void recoverRing(batch_t * batch, ring_t * ring, const int * inFlight, int active, int worker) {
+    int running[filesInFlight];
+    int completed[filesInFlight];
+    int results[filesInFlight];
+    int numRunning = active;
+
+    for (int j = 0; j < active; ++j) {
+        running[j] = 1;
+        completed[j] = 0;
+        results[j] = 0;
+    }
+
+    // requests still in the submission queue will never run
+    for (unsigned head = *ring->sqHead; head != *ring->sqTail; ++head) {
+        struct io_uring_sqe * sqe = ring->sqes + (head & *ring->sqMask);
+
+        if (!sqe->user_data && sqe->opcode == IORING_OP_CLOSE) {
+            close(sqe->fd);
+        }
+
+        for (int j = 0; sqe->user_data && j < active; ++j) {
+            if (running[j] && inFlight[j] == (int) sqe->user_data - 1) {
+                running[j] = 0;
+                --numRunning;
+            }
+        }
+    }
+
+    ring->pending = 0;
+
+    while (numRunning) {
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe * cqe = ring->cqes + (head & *ring->cqMask);
+
+            for (int j = 0; cqe->user_data && j < active; ++j) {
+                if (running[j] && inFlight[j] == (int) cqe->user_data - 1) {
+                    running[j] = 0;
+                    completed[j] = 1;
+                    results[j] = cqe->res;
+                    --numRunning;
+                }
+            }
+
+            __atomic_store_n(ring->cqHead, ++head, __ATOMIC_RELEASE);
+        }
+
+        // the kernel still posts completions if it cannot be waited on, so they are polled for
+        if (numRunning && enterRing(ring, 1)) {
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    closeRing(ring);
+
+    for (int j = 0; j < active; ++j) {
+        if (rewindFile(batch, inFlight[j], completed[j], results[j])) {
+            processBlocking(batch, inFlight[j], worker);
+        }
+    }
+}
+
+// returns nonzero if io_uring fails, once the files in flight are redone, leaving the rest for blocking I/O
+static int processUring(batch_t * batch, int worker) {
+    ring_t ring;
+
+    if (openRing(&ring, filesInFlight * 2)) {
+        return 1;
+    }
+
+    int inFlight[filesInFlight];
+    int active = 0;
+    int exhausted = 0;
+
+    while (active || !exhausted) {
+        // requests left unsubmitted hold their place in the queue, so no files are added until they are taken
+        while (!exhausted && !ring.pending && active < filesInFlight) {
+            int i = claimFile(batch);
+            if (i < 0) {
+                exhausted = 1;
+                break;
+            }
+
+            batch->progress[i].step = openingSource;
+            queueOpen(&ring, batch->files[i].path, O_RDONLY, 0, i);
+            inFlight[active++] = i;
+        }
+
+        if (enterRing(&ring, active ? 1 : 0)) {
+            recoverRing(batch, &ring, inFlight, active, worker);
+            return 1;
+        }
+
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe * cqe = ring.cqes + (head & *ring.cqMask);
+            uint64_t data = cqe->user_data;
+            int result = cqe->res;
+
+            __atomic_store_n(ring.cqHead, ++head, __ATOMIC_RELEASE);
+
+            if (data && advance(batch, &ring, data - 1, result, worker)) {
+                for (int j = 0; j < active; ++j) {
+                    if (inFlight[j] == (int) data - 1) {
+                        inFlight[j] = inFlight[--active];
+                        break;
+                    }
+                }
+            }
+
+            tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    // flush closes of source files before the ring goes away
+    enterRing(&ring, 0);
+    closeRing(&ring);
+    return 0;
+}
+#endif
+
+static void * runWorker(void * arg) {
+    worker_t * worker = arg;
+    batch_t * batch = worker->batch;
+
+#ifdef useUring
+    if (!processUring(batch, worker->worker)) {
+        return NULL;
+    }
+#endif
+
+    for (int i = claimFile(batch); i >= 0; i = claimFile(batch)) {
+        processBlocking(batch, i, worker->worker);
+    }
+
+    return NULL;
+}
+
+int runBatch(batchFile_t * files, int numFiles, int numWorkers, batchFormat_t format, void * user) {
+    batch_t batch;
+    batch.files = files;
+    batch.progress = calloc(numFiles ? numFiles : 1, sizeof(progress_t));
+    batch.numFiles = numFiles;
+    batch.nextFile = 0;
+    batch.failures = 0;
+    batch.format = format;
+    batch.user = user;
+
+    if (!batch.progress) {
+        fprintf(stderr, "failed to allocate batch\n");
+        return numFiles;
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+
+    if (numWorkers > numFiles) {
+        numWorkers = numFiles;
+    }
+
+    if (numWorkers < 1) {
+        numWorkers = 1;
+    }
+
+    worker_t workers[numWorkers];
+    pthread_t threads[numWorkers];
+    int started = 1;
+
+    for (int i = 0; i < numWorkers; ++i) {
+        workers[i].batch = &batch;
+        workers[i].worker = i;
+    }
+
+    while (started < numWorkers && !pthread_create(threads + started, NULL, runWorker, workers + started)) {
+        ++started;
+    }
+
+    runWorker(workers);
+
+    for (int i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.progress);
+    return batch.failures;
+}
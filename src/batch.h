@@ -0,0 +1,38 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+/*
+ * Batched file I/O for the caddy65 command line tool.
+ *
+ * Each worker keeps many files in flight, so reads, writes, and renames
+ * overlap with formatting. On Linux, workers drive their own io_uring;
+ * elsewhere, or if io_uring is unavailable, each worker processes its files
+ * with blocking I/O.
+ */
+
+typedef struct {
+    const char * path;
+    char * input;
+    size_t inputSize;
+    char * output;
+    size_t outputSize;
+    int failed;
+} batchFile_t;
+
+/*
+ * Called once the contents of a file are available in input.
+ * To replace the file, store a malloc'd buffer in output, which the batch
+ * frees once written. Leaving output NULL leaves the file untouched.
+ * Set failed to report an error for the file.
+ */
+typedef void (* batchFormat_t)(batchFile_t * file, int worker, void * user);
+
+/*
+ * Reads, formats, and writes back each file using up to numWorkers threads.
+ * Returns the number of files that failed.
+ */
+int runBatch(batchFile_t * files, int numFiles, int numWorkers, batchFormat_t format, void * user);
+
+#endif
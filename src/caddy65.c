@@ -1,1024 +1,552 @@
-#include <ctype.h>
-#include <regex.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "caddy65.h"
+#include "jobserver.h"
+#include "verify.h"
 
-const char * const temp = ".temp.s";
-const char * const indention = "  ";
-const char * const labeledIndention = ": ";
-const char * const preformatted = "#pre-formatted";
-const char * const preformattedStart = "#pre-formatted-start";
-const char * const preformattedEnd = "#pre-formatted-end";
 const char * const defaultConfig = "caddy65.cfg";
+const char * const verifyCache = "caddy65.cache";
+const int maxIncludeDepth = 16;
 
-const int verbose = 0;
-const int pedantic = 0;
-
-char scratch[4096];
-int indentionSize;
-
-#define spacing "([[:space:]]*)"
-#define comment spacing ";" spacing "(.?)"
-
-#define leadingSpace "^" spacing
-#define trailingSpace spacing "$"
-#define tab "(\t)"
-
-#define bitwise "^(and|eor|ora)"
-
-#define address "[^#][$]([[:xdigit:]]+)"
-#define hexLiteral "[#][$]([[:xdigit:]]+)"
-#define binaryLiteral "[#][%]([01]{1,8})"
-
-#define openParen spacing "[(]" spacing
-#define closeParen spacing "[)]" spacing
-#define comma spacing "," spacing
-
-#define operator "([-+*/&|^=<>\\]|"\
-                 "<<|>>|<>|<=|>=|&&|[|][|]|"\
-                 "[.](mod|bitand|bitor|bitxor|shl|shr|and|or|xor))"
-#define byteOperator spacing "([#][<>])" spacing
-
-#define argStart "([$%\"_[:alnum:]])"
-#define control "[.]([[:alpha:]][[:alnum:]]*)" spacing argStart "?"
-#define symbol "([_[:alpha:]]([_[:alnum:]]|(::))*)"
-#define macroDef "^[.]macro" spacing "([^[:space:]]+)(" spacing "([^,[:space:]]*))"
-#define macroUse "^" symbol "((([[:space:]]+)" argStart ")|$)"
-#define label "^([@_[:alpha:]][_[:alnum:]]*)" spacing ":" spacing "([^+-]|$)"
-#define unnamed "^:" spacing
-#define relative ":([+]+|[-]+)"
-#define index spacing "," spacing "([XYxy])"
-#define indirection "[(]" spacing "([^,)[:space:]]+)" spacing "[)]"
-#define indirectionX "[(]" spacing "([^,)[:space:]]+)" spacing "," spacing "([Xx])" spacing "[)]"
-#define indirectionY "[(]" spacing "([^,)[:space:]]+)" spacing "[)]" spacing "," spacing "([Yy])"
-#define instruction "^(adc|and|asl|bcc|bcs|beq|bit|bmi|bne|bpl|brk|bvc|bvs|clc|"\
-                      "cld|cli|clv|cmp|cpx|cpy|dec|dex|dey|eor|inc|inx|iny|jmp|"\
-                      "jsr|lda|ldx|ldy|lsr|nop|ora|pha|php|pla|plp|rol|ror|rti|"\
-                      "rts|sbc|sec|sed|sei|sta|stx|sty|tax|tay|tsx|txa|txs|tya)"
-
-#define matchLength(n) (match[n].rm_eo - match[n].rm_so)
-
-typedef enum {
-    onlyComment,
-    trimLeading,
-    trimTrailing,
-    tabExpansion,
-    bitwiseInstruction,
-    addressFormatting,
-    hexLiteralFormatting,
-    binaryLiteralFormatting,
-    openParenSpacing,
-    closeParenSpacing,
-    operatorFormatting,
-    byteOperatorFormatting,
-    commaSpacing,
-    controlCommand,
-    macroDefinition,
-    macroInstance,
-    namedLabel,
-    unnamedLabel,
-    impliedInstruction,
-    immediateInstruction,
-    addressInstruction,
-    indexedInstruction,
-    indirectInstruction,
-    indirectXInstruction,
-    indirectYInstruction,
-    relativeInstruction,
-    commentSpacing,
-    numRules,
-} rule_t;
-
-const char * ruleNames[numRules] = {
-    "onlyComment",
-    "trimLeading",
-    "trimTrailing",
-    "tabExpansion",
-    "bitwiseInstruction",
-    "addressFormatting",
-    "hexLiteralFormatting",
-    "binaryLiteralFormatting",
-    "openParenSpacing",
-    "closeParenSpacing",
-    "operatorFormatting",
-    "byteOperatorFormatting",
-    "commaSpacing",
-    "controlCommand",
-    "macroDefinition",
-    "macroInstance",
-    "namedLabel",
-    "unnamedLabel",
-    "impliedInstruction",
-    "immediateInstruction",
-    "addressInstruction",
-    "indexedInstruction",
-    "indirectInstruction",
-    "indirectXInstruction",
-    "indirectYInstruction",
-    "relativeInstruction",
-    "commentSpacing",
-};
-
-const char * patterns[numRules] = {
-    "^" comment,
-    leadingSpace,
-    trailingSpace,
-    tab,
-    bitwise,
-    address,
-    hexLiteral,
-    binaryLiteral,
-    openParen,
-    closeParen,
-    "[^(#:+-]" spacing operator spacing "([^[:space:]]?)",
-    byteOperator,
-    comma,
-    control,
-    macroDef,
-    macroUse,
-    label,
-    unnamed,
-    instruction spacing "(;|$)",
-    instruction spacing "(#)",
-    instruction spacing "([$])",
-    instruction spacing "([^,[:space:]]+)" index,
-    instruction spacing indirection,
-    instruction spacing indirectionX,
-    instruction spacing indirectionY,
-    instruction spacing relative,
-    comment,
-};
-
-typedef enum {
-    appendNewline = 1 << 0,
-    prependIndention = 1 << 1,
-    prependLabel = 1 << 2,
-    bitwiseOperation = 1 << 3,
-    done = 1 << 4,
-    omit = 1 << 5,
-} flags_t;
-
-typedef enum {
-    notApplied,
-    compliant,
-    applied,
-    error,
-} result_t;
-
-const char * resultNames[] = {
-    "notApplied",
-    "compliant",
-    "applied",
-    "error",
-};
-
-void printError(int errorCode, regex_t * regex) {
-    regerror(errorCode, regex, scratch, 4096);
-    fprintf(stderr, "%s\n", scratch);
-}
+char * readFile(const char * path, size_t * size) {
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
 
-void printLineResult(FILE * output, const char * source, flags_t flags, int skipped) {
-    int len = strlen(source);
+    size_t capacity = 4096;
+    size_t length = 0;
+    char * buffer = malloc(capacity);
 
-    if (skipped) {
-        if (verbose) {
-            printf("preformatted:\n%s", source);
-        }
-        fprintf(output, "%s", source);
-    } else if (flags & omit) {
-        if (verbose) {
-            printf("<omitted blank line>\n");
+    while (buffer) {
+        length += fread(buffer + length, 1, capacity - length - 1, file);
+
+        if (length < capacity - 1) {
+            break;
         }
-    } else {
-        sprintf(scratch, "%s%.*s%s",
-               flags & prependLabel ? ":" : "",
-               flags & prependLabel ? indentionSize - 1 : indentionSize,
-               len && flags & (prependLabel | prependIndention) ? indention : "",
-               source);
-
-        if (verbose) {
-            printf("\"%s\"\n", scratch);
+
+        capacity *= 2;
+        char * grown = realloc(buffer, capacity);
+        if (!grown) {
+            free(buffer);
         }
+        buffer = grown;
+    }
 
-        fprintf(output, "%s%s",
-            scratch,
-            flags & appendNewline ? "\n" : "");
+    if (buffer && ferror(file)) {
+        free(buffer);
+        buffer = NULL;
     }
+
+    fclose(file);
+
+    if (buffer) {
+        buffer[length] = '\0';
+        *size = length;
+    }
+
+    return buffer;
 }
 
-void printRuleResult(rule_t rule, result_t result, flags_t flags) {
-    if (pedantic) {
-        printf("%24.24s: %10.10s, flags: %d\n", ruleNames[rule], resultNames[result], flags);
+typedef struct {
+    char * path;
+    caddy65_macros_t * macros;
+} include_t;
+
+// every file in the batch shares the scans of its includes, so each include is read once
+typedef struct {
+    include_t * entries;
+    int numEntries;
+    pthread_mutex_t lock;
+} includes_t;
+
+typedef struct {
+    includes_t * includes;
+    int depth;
+} scan_t;
+
+const caddy65_macros_t * findInclude(includes_t * includes, const char * path) {
+    const caddy65_macros_t * macros = NULL;
+    pthread_mutex_lock(&includes->lock);
+
+    for (int i = 0; !macros && i < includes->numEntries; ++i) {
+        if (strcmp(includes->entries[i].path, path) == 0) {
+            macros = includes->entries[i].macros;
+        }
     }
+
+    pthread_mutex_unlock(&includes->lock);
+    return macros;
 }
 
-void cleanup(FILE * input, FILE * output, regex_t * regex) {
-    fclose(input);
-    fclose(output);
+// takes ownership of macros, returning the scan stored for path or NULL if it cannot be stored
+const caddy65_macros_t * addInclude(includes_t * includes, const char * path, caddy65_macros_t * macros) {
+    const caddy65_macros_t * found = NULL;
+    pthread_mutex_lock(&includes->lock);
 
-    for (int i = 0; i < numRules; ++i) {
-        regfree(regex + i);
+    // another worker may have scanned the same include in the meantime
+    for (int i = 0; !found && i < includes->numEntries; ++i) {
+        if (strcmp(includes->entries[i].path, path) == 0) {
+            found = includes->entries[i].macros;
+        }
     }
+
+    if (!found) {
+        size_t length = strlen(path);
+        include_t * entries = realloc(includes->entries, (includes->numEntries + 1) * sizeof(include_t));
+        char * copy = malloc(length + 1);
+
+        if (entries) {
+            includes->entries = entries;
+        }
+
+        if (entries && copy) {
+            memcpy(copy, path, length + 1);
+            includes->entries[includes->numEntries].path = copy;
+            includes->entries[includes->numEntries++].macros = macros;
+            found = macros;
+            macros = NULL;
+        } else {
+            fprintf(stderr, "failed to allocate include list\n");
+            free(copy);
+        }
+    }
+
+    pthread_mutex_unlock(&includes->lock);
+    caddy65MacrosFree(macros);
+    return found;
 }
 
-result_t applyRule(rule_t rule, char * const source, const flags_t flags, regex_t * regex) {
-    regmatch_t match[16];
-    int status = regexec(regex, source, 16, match, 0);
+void freeIncludes(includes_t * includes) {
+    for (int i = 0; i < includes->numEntries; ++i) {
+        free(includes->entries[i].path);
+        caddy65MacrosFree(includes->entries[i].macros);
+    }
 
-    if (!status) {
-        switch (rule) {
-            case onlyComment: {
-                return compliant;
-            }
-            case trimLeading: {
-                int s1 = matchLength(1);
+    free(includes->entries);
+    pthread_mutex_destroy(&includes->lock);
+}
 
-                if (s1) {
-                    sprintf(scratch, "%s", source + match[1].rm_eo);
-                    strcpy(source, scratch);
-                    return applied;
-                }
+caddy65_status_t scanInclude(caddy65_macros_t * macros, const char * path, void * user) {
+    scan_t * scan = user;
+    const caddy65_macros_t * found = findInclude(scan->includes, path);
 
-                return compliant;
-            }
-            case trimTrailing: {
-                int s1 = matchLength(1);
+    if (!found) {
+        if (scan->depth >= maxIncludeDepth) {
+            fprintf(stderr, "include depth exceeded while scanning macros: %s\n", path);
+            return caddy65Success;
+        }
 
-                if (s1) {
-                    source[match[1].rm_so] = '\0';
-                    return applied;
-                }
+        caddy65_macros_t * scanned = caddy65MacrosCreate();
+        if (!scanned) {
+            return caddy65Error;
+        }
 
-                return compliant;
-            }
-            case tabExpansion: {
-                sprintf(scratch, "%.*s%s%s",
-                    (int) match[1].rm_so, source,
-                    indention,
-                    source + match[1].rm_eo);
-                strcpy(source, scratch);
-
-                result_t result = applied;
-                result_t next = applyRule(rule, source + match[1].rm_so + indentionSize, flags, regex);
-                return next > result ? next : result;
-            }
-            case bitwiseInstruction: {
-                return compliant;
-            }
-            case addressFormatting: {
-                result_t result = compliant;
-
-                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
-                    if (isupper(source[i])) {
-                        source[i] = tolower(source[i]);
-                        result = applied;
-                    }
-                }
-
-                int s1 = matchLength(1);
-                if (s1 & 1) {
-                    sprintf(scratch, "%.*s0%s",
-                        (int) match[1].rm_so, source,
-                        source + match[1].rm_so);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_so, flags, regex);
-                return next > result ? next : result;
-            }
-            case hexLiteralFormatting: {
-                result_t result = compliant;
-
-                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
-                    if (isupper(source[i])) {
-                        source[i] = tolower(source[i]);
-                        result = applied;
-                    }
-                }
-
-                if (flags & bitwiseOperation) {
-                    int s1 = matchLength(1);
-
-                    if (s1 & 1) {
-                        sprintf(scratch, "%.*s0%s",
-                            (int) match[1].rm_so, source,
-                            source + match[1].rm_so);
-                        strcpy(source, scratch);
-                        result = applied;
-                    }
-                } else {
-                    int offset = match[1].rm_so;
-                    while (source[offset] == '0' && isxdigit(source[offset + 1])) {
-                        ++offset;
-                    }
-
-                    if (offset != match[1].rm_so) {
-                        sprintf(scratch, "%.*s%s",
-                            (int) match[1].rm_so, source,
-                            source + offset);
-                        strcpy(source, scratch);
-                        result = applied;
-                    }
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_so, flags, regex);
-                return next > result ? next : result;
-            }
-            case binaryLiteralFormatting: {
-                result_t result = compliant;
-                int s1 = matchLength(1);
-
-                if (s1 != 8) {
-                    sprintf(scratch, "%.*s%.*s%s",
-                        (int) match[1].rm_so, source,
-                        8 - s1, "00000000",
-                        source + match[1].rm_so);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_so, flags, regex);
-                return next > result ? next : result;
-            }
-            case openParenSpacing: {
-                char * commentStart = strchr(source, ';');
-                if (commentStart && source + match[0].rm_so >= commentStart) {
-                    return notApplied;
-                }
-
-                result_t result = compliant;
-                int s1 = matchLength(1);
-                int s2 = matchLength(2);
-
-                if (s1 || s2) {
-                    sprintf(scratch, "%.*s(%s",
-                        (int) match[1].rm_so, source,
-                        source + match[2].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_eo + 1, flags, regex);
-                return next > result ? next : result;
-            }
-            case closeParenSpacing: {
-                char * commentStart = strchr(source, ';');
-                if (commentStart && source + match[0].rm_so >= commentStart) {
-                    return notApplied;
-                }
-
-                result_t result = compliant;
-                int s1 = matchLength(1);
-                int s2 = matchLength(2);
-
-                if (s1 || s2) {
-                    sprintf(scratch, "%.*s)%s",
-                        (int) match[1].rm_so, source,
-                        source + match[2].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_eo + 1, flags, regex);
-                return next > result ? next : result;
-            }
-            case operatorFormatting: {
-                char * commentStart = strchr(source, ';');
-                if (commentStart && source + match[0].rm_so >= commentStart) {
-                    return notApplied;
-                }
-
-                int inQuote = 0;
-                for (int i = 0; i < match[0].rm_so; ++i) {
-                    if (source[i] == '"') {
-                        inQuote ^= 1;
-                    }
-                }
-
-                if (inQuote) {
-                    char * next = source + match[2].rm_eo;
-                    while (*next && *next != '"') {
-                        ++next;
-                    }
-
-                    if (*next) {
-                        return applyRule(rule, next, flags, regex);
-                    }
-
-                    fprintf(stderr, "rule %d failed to parse quoted section\n", rule);
-                    return error;
-                }
-
-                result_t result = compliant;
-                int s2 = matchLength(2);
-
-                if (s2 > 2) {
-                    for (int i = match[2].rm_so; i < match[2].rm_eo; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-                }
-
-                int s1 = matchLength(1);
-                int s4 = matchLength(4);
-                int s5 = matchLength(5);
-
-                if (s1 != 1 || (s4 != 1 && s5) || (s4 && !s5)) {
-                    sprintf(scratch, "%.*s %.*s%.*s%s",
-                        (int) match[1].rm_so, source,
-                        s2, source + match[2].rm_so,
-                        s5, " ",
-                        source + match[4].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_so + s2 + 2, flags, regex);
-                return next > result ? next : result;
-            }
-            case byteOperatorFormatting: {
-                result_t result = compliant;
-                int s1 = matchLength(1);
-                int s3 = matchLength(3);
-
-                if (s1 != 1 || s3) {
-                    sprintf(scratch, "%.*s %.*s%s",
-                        (int) match[1].rm_so, source,
-                        2, source + match[2].rm_so,
-                        source + match[2].rm_eo + 1);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_so + 3, flags, regex);
-                return next > result ? next : result;
-            }
-            case commaSpacing: {
-                char * commentStart = strchr(source, ';');
-                if (commentStart && source + match[0].rm_so >= commentStart) {
-                    return notApplied;
-                }
-
-                result_t result = compliant;
-                int s1 = matchLength(1);
-                int s2 = matchLength(2);
-
-                if (s1 || s2 != 1) {
-                    sprintf(scratch, "%.*s, %s",
-                        (int) match[1].rm_so, source,
-                        source + match[2].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                result_t next = applyRule(rule, source + match[1].rm_eo + 1, flags, regex);
-                return next > result ? next : result;
-            }
-            case controlCommand: {
-                result_t result = compliant;
-
-                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
-                    if (isupper(source[i])) {
-                        source[i] = tolower(source[i]);
-                        result = applied;
-                    }
-                }
-
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-
-                if (s2 > 1 && s3) {
-                    sprintf(scratch, "%.*s %s",
-                        (int) match[2].rm_so, source,
-                        source + match[3].rm_so);
-                    strcpy(source, scratch);
-                    result = applied;
-                }
-
-                return result;
-            }
-            case macroDefinition: {
-                int s1 = matchLength(1);
-                int s3 = matchLength(3);
-                int s4 = matchLength(4);
-
-                if (s1 != 1 || (s3 && s4 != 1)) {
-                    int s2 = matchLength(2);
-
-                    sprintf(scratch, "%.*s %.*s%s%s",
-                        (int) match[1].rm_so, source,
-                        s2, source + match[2].rm_so,
-                        s3 ? " " : "",
-                        source + match[5].rm_so);
-                    strcpy(source, scratch);
-                    return applied;
-                }
-
-                return compliant;
+        size_t size;
+        char * buffer = readFile(path, &size);
+
+        // missing includes are left for ca65 to report, and define no macros
+        if (buffer) {
+            scan_t nested = { scan->includes, scan->depth + 1 };
+            caddy65_status_t status = caddy65MacrosScan(scanned, buffer, size, scanInclude, &nested);
+            free(buffer);
+
+            if (status != caddy65Success) {
+                caddy65MacrosFree(scanned);
+                return status;
             }
-            case macroInstance: {
-                int s4 = matchLength(4);
-                int s6 = matchLength(6);
+        }
 
-                if (s4 && s6 != 1) {
-                    int s1 = matchLength(1);
+        found = addInclude(scan->includes, path, scanned);
+        if (!found) {
+            return caddy65Error;
+        }
+    }
 
-                    sprintf(scratch, "%.*s %s",
-                        s1, source,
-                        source + match[7].rm_so);
-                    strcpy(source, scratch);
-                    return applied;
-                }
+    return caddy65MacrosMerge(macros, found);
+}
 
-                return compliant;
-            }
-            case namedLabel: {
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-                int s4 = matchLength(4);
-
-                if (s2 || (s3 != 1 && s4)) {
-                    int s1 = matchLength(1);
-
-                    sprintf(scratch, "%.*s:%s%s",
-                        s1, source,
-                        s4 ? " " : "",
-                        source + match[4].rm_so);
-                    strcpy(source, scratch);
-                    return applied;
-                }
-
-                return compliant;
-            }
-            case unnamedLabel: {
-                sprintf(scratch, "%s", source + match[1].rm_eo);
-                strcpy(source, scratch);
+typedef struct {
+    caddy65_t ** contexts;
+    caddy65_stats_t * stats;
+    batchFile_t * files;
+    size_t * changedLines;
+    verifier_t * verifier;
+    includes_t * includes;
+    int useMacros;
+    int checkOnly;
+} formatter_t;
+
+typedef struct {
+    uint64_t size;
+    uint64_t hash;
+    int index;
+} shardEntry_t;
+
+int compareShardEntries(const void * a, const void * b) {
+    const shardEntry_t * x = a;
+    const shardEntry_t * y = b;
+
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
 
-                return applied;
-            }
-            case impliedInstruction: {
-                result_t result = compliant;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
 
-                for (int i = 0; i < 3; ++i) {
-                    if (isupper(source[i])) {
-                        source[i] = tolower(source[i]);
-                        result = applied;
-                    }
-                }
+    return x->index - y->index;
+}
 
-                return result;
-            }
-            case immediateInstruction:
-            case addressInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-
-                if (s2 != 1) {
-                    sprintf(scratch, "%c%c%c %s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        source + match[3].rm_so);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-                }
-
-                return result;
-            }
-            case indexedInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-                int s4 = matchLength(4);
-                int s5 = matchLength(5);
-                int idx = match[6].rm_so;
-
-                if (s2 != 1 || s4 || s5 != 1) {
-                    int s3 = matchLength(3);
-
-                    sprintf(scratch, "%c%c%c %.*s, %c%s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        s3, source + match[3].rm_so,
-                        tolower(source[idx]),
-                        source + match[6].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-
-                    if (isupper(source[idx])) {
-                        source[idx] = tolower(source[idx]);
-                        result = applied;
-                    }
-                }
-
-                return result;
-            }
-            case indirectInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-                int s5 = matchLength(5);
-
-                if (s2 != 1 || s3 || s5) {
-                    int s4 = matchLength(4);
-
-                    sprintf(scratch, "%c%c%c (%.*s)%s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        s4, source + match[4].rm_so,
-                        source + match[5].rm_eo + 1);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-                }
-
-                return result;
-            }
-            case indirectXInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-                int s5 = matchLength(5);
-                int s6 = matchLength(6);
-                int s8 = matchLength(8);
-
-                if (s2 != 1 || s3 || s5 || s6 != 1 || s8) {
-                    int s4 = matchLength(4);
-
-                    sprintf(scratch, "%c%c%c (%.*s, x)%s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        s4, source + match[4].rm_so,
-                        source + match[8].rm_eo + 1);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-
-                    int idx = match[7].rm_so;
-                    if (source[idx] == 'X') {
-                        source[idx] = 'x';
-                        result = applied;
-                    }
-                }
-
-                return result;
-            }
-            case indirectYInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-                int s5 = matchLength(5);
-                int s6 = matchLength(6);
-                int s7 = matchLength(7);
-
-                if (s2 != 1 || s3 || s5 || s6 || s7 != 1) {
-                    int s4 = matchLength(4);
-
-                    sprintf(scratch, "%c%c%c (%.*s), y%s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        s4, source + match[4].rm_so,
-                        source + match[8].rm_eo);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-
-                    int idx = match[8].rm_so;
-                    if (source[idx] == 'Y') {
-                        source[idx] = 'y';
-                        result = applied;
-                    }
-                }
-
-                return result;
-            }
-            case relativeInstruction: {
-                result_t result = compliant;
-                int s2 = matchLength(2);
-
-                if (s2 != 1) {
-                    sprintf(scratch, "%c%c%c :%s",
-                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
-                        source + match[3].rm_so);
-                    strcpy(source, scratch);
-                    result = applied;
-                } else {
-                    for (int i = 0; i < 3; ++i) {
-                        if (isupper(source[i])) {
-                            source[i] = tolower(source[i]);
-                            result = applied;
-                        }
-                    }
-                }
-
-                return result;
-            }
-            case commentSpacing: {
-                int s1 = matchLength(1);
-                int s2 = matchLength(2);
-                int s3 = matchLength(3);
-
-                if (s1 != 1 || (s2 != 1 && s3)) {
-                    int mlp = match[1].rm_eo == 0 ? 0 : 1;
-                    int mtp = !s3 ? 0 : 1;
-
-                    sprintf(scratch, "%.*s%*.*s;%*.*s%s",
-                        (int) match[0].rm_so, source,
-                        mlp, s1 > mlp ? s1 : mlp, s1 ? source + match[1].rm_so : " ",
-                        mtp, s2 > mtp ? s2 : mtp, s2 ? source + match[2].rm_so : " ",
-                        source + match[3].rm_so);
-                    strcpy(source, scratch);
-
-                    return applied;
-                }
-
-                return compliant;
-            }
-            default: {
-                return error;
+// keeps the files assigned to shard (zero-based) of numShards, preserving order
+int shardFiles(batchFile_t * files, int numFiles, int shard, int numShards) {
+    shardEntry_t * entries = malloc(numFiles * sizeof(shardEntry_t));
+    uint64_t * loads = calloc(numShards, sizeof(uint64_t));
+    int * owners = malloc(numFiles * sizeof(int));
+
+    if (!entries || !loads || !owners) {
+        free(entries);
+        free(loads);
+        free(owners);
+        return -1;
+    }
+
+    for (int i = 0; i < numFiles; ++i) {
+        struct stat st;
+        uint64_t hash = 14695981039346656037ull;
+
+        for (const char * c = files[i].path; *c; ++c) {
+            hash ^= (uint8_t) *c;
+            hash *= 1099511628211ull;
+        }
+
+        entries[i].size = stat(files[i].path, &st) ? 0 : st.st_size;
+        entries[i].hash = hash;
+        entries[i].index = i;
+    }
+
+    // largest files first, each to the least loaded shard
+    qsort(entries, numFiles, sizeof(shardEntry_t), compareShardEntries);
+
+    for (int i = 0; i < numFiles; ++i) {
+        int lightest = 0;
+        for (int j = 1; j < numShards; ++j) {
+            if (loads[j] < loads[lightest]) {
+                lightest = j;
             }
         }
-    } else if (status == REG_NOMATCH) {
-        return notApplied;
-    } else {
-        fprintf(stderr, "\"%s\" failed to match (%d):\n", ruleNames[rule], status);
-        fprintf(stderr, "string: %s\n", source);
-        fprintf(stderr, "pattern: %s\n", patterns[rule]);
-        printError(status, regex);
-        return error;
+
+        // every file costs at least one unit so empty files still spread out
+        loads[lightest] += entries[i].size + 1;
+        owners[entries[i].index] = lightest;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < numFiles; ++i) {
+        if (owners[i] == shard) {
+            files[kept++] = files[i];
+        }
     }
 
-    return error;
+    free(entries);
+    free(loads);
+    free(owners);
+    return kept;
 }
 
-int main(int argc, char ** argv) {
-    if (argc != 2 && argc != 4) {
-        fprintf(stderr, "usage: %s [-c config.cfg] <source.s>\n", argv[0]);
+int writeReport(const char * path, const formatter_t * formatter, int numFiles) {
+    FILE * report = fopen(path, "w");
+    if (!report) {
+        fprintf(stderr, "failed to create report file: %s\n", path);
         return 1;
     }
 
-    const char * sourceCode = argv[1];
-    const char * config = defaultConfig;
+    for (int i = 0; i < numFiles; ++i) {
+        const batchFile_t * file = formatter->files + i;
 
-    if (argc == 4) {
-        if (strcmp(argv[1], "-c") == 0) {
-            config = argv[2];
-            sourceCode = argv[3];
-        } else if (strcmp(argv[2], "-c") == 0) {
-            config = argv[3];
-            sourceCode = argv[1];
+        if (file->failed) {
+            fprintf(report, "failed\t-\t%s\n", file->path);
+        } else if (formatter->changedLines[i]) {
+            fprintf(report, "changed\t%zu\t%s\n", formatter->changedLines[i], file->path);
         } else {
-            fprintf(stderr, "usage: %s [-c config.cfg] <source.s>\n", argv[0]);
-            return 1;
+            fprintf(report, "ok\t0\t%s\n", file->path);
         }
     }
 
-    char source[4096];
-    uint32_t enabled = ~0u;
+    if (fclose(report)) {
+        fprintf(stderr, "failed to write report file: %s\n", path);
+        return 1;
+    }
 
-    FILE * cfg = fopen(config, "r");
-    if (cfg) {
-        while (fgets(source, 4096, cfg)) {
-            char * c = strchr(source, ':');
+    return 0;
+}
 
-            if (!c) {
-                fprintf(stderr, "failed to read config file: %s\n", config);
-                return 1;
-            }
+void formatSource(batchFile_t * file, int worker, void * user) {
+    formatter_t * formatter = user;
+    caddy65_t * ctx = formatter->contexts[worker];
 
-            int enable = strstr(c, "enabled") ? 1 : 0;
+    // each file only sees its own macros and those of its includes, whatever else is in the batch
+    scan_t scan = { formatter->includes, 0 };
+    caddy65_macros_t * macros = NULL;
 
-            *c = '\0';
-            int found = 0;
+    if (formatter->useMacros) {
+        macros = caddy65MacrosCreate();
 
-            for (int i = 0; i < numRules; ++i) {
-                if (strcmp(ruleNames[i], source) == 0) {
-                    if (enable) {
-                        enabled |= (1u << i);
-                    } else {
-                        enabled &= ~(1u << i);
-                    }
+        if (!macros || caddy65MacrosScan(macros, file->input, file->inputSize,
+            formatter->includes ? scanInclude : NULL, &scan)) {
 
-                    found = 1;
-                    break;
-                }
-            }
+            caddy65MacrosFree(macros);
+            file->failed = 1;
+            return;
+        }
+    }
 
-            if (!found) {
-                printf("unknown rule read from config file: \"%s\"\n", source);
-            }
+    caddy65UseMacros(ctx, macros);
+
+    size_t outputSize = file->inputSize * 2 + 4096;
+    char * output = NULL;
+    caddy65_status_t status = caddy65Overflow;
+    caddy65_stats_t before;
+    caddy65_stats_t after;
+
+    while (status == caddy65Overflow) {
+        free(output);
+        output = malloc(outputSize);
+
+        if (!output) {
+            fprintf(stderr, "failed to allocate output buffer\n");
+            status = caddy65Error;
+            break;
         }
 
-        fclose(cfg);
-    } else if (argc == 4) {
-        fprintf(stderr, "failed to open config file: %s\n", config);
-        return 1;
+        caddy65Stats(ctx, &before);
+        status = caddy65FormatBuffer(ctx, file->input, file->inputSize, output, outputSize, &file->outputSize);
+        outputSize *= 2;
     }
 
-    FILE * input = fopen(sourceCode, "r");
-    if (!input) {
-        fprintf(stderr, "failed to open source file: %s\n", sourceCode);
+    caddy65UseMacros(ctx, NULL);
+    caddy65MacrosFree(macros);
+    caddy65Stats(ctx, &after);
+
+    // attempts that overflowed are not counted
+    caddy65_stats_t * stats = formatter->stats + worker;
+    stats->lines += after.lines - before.lines;
+    stats->preformattedLines += after.preformattedLines - before.preformattedLines;
+    stats->changedLines += after.changedLines - before.changedLines;
+    stats->cacheHits += after.cacheHits - before.cacheHits;
+    stats->cacheMisses += after.cacheMisses - before.cacheMisses;
+
+    formatter->changedLines[file - formatter->files] = after.changedLines - before.changedLines;
+
+    if (status != caddy65Success) {
+        fprintf(stderr, "failed to format source file: %s\n", file->path);
+        free(output);
+        file->failed = 1;
+    } else if (after.changedLines == before.changedLines || formatter->checkOnly) {
+        free(output);
+    } else if (formatter->verifier &&
+        verifySource(formatter->verifier, file->path, file->input, file->inputSize, output, file->outputSize)) {
+
+        // leaves the file untouched
+        free(output);
+        file->failed = 1;
+    } else {
+        file->output = output;
+    }
+}
+
+void printUsage(const char * name) {
+    fprintf(stderr, "usage: %s [-c config.cfg] [-m] [-i] [-s] [--check] [--verify] [--blocks] [--shard i/N] [--report report.txt] <source.s>...\n", name);
+}
+
+int main(int argc, char ** argv) {
+    const char * config = NULL;
+    int printStats = 0;
+    int useMacros = 0;
+    int followIncludes = 0;
+    int checkOnly = 0;
+    int verify = 0;
+    int blocks = 0;
+    int shard = 0;
+    int numShards = 1;
+    int shardLen = 0;
+    const char * reportPath = NULL;
+    int numFiles = 0;
+    batchFile_t * files = calloc(argc, sizeof(batchFile_t));
+
+    if (!files) {
+        fprintf(stderr, "failed to allocate file list\n");
         return 1;
     }
 
-    FILE * output = fopen(temp, "w");
-    if (!output) {
-        fprintf(stderr, "failed to create temporary file\n");
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && !config) {
+            config = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0) {
+            useMacros = 1;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            useMacros = 1;
+            followIncludes = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            printStats = 1;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            checkOnly = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "--blocks") == 0) {
+            blocks = 1;
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc &&
+            sscanf(argv[i + 1], "%d/%d%n", &shard, &numShards, &shardLen) == 2 && !argv[i + 1][shardLen] &&
+            numShards > 0 && shard > 0 && shard <= numShards) {
+
+            --shard;
+            ++i;
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc && !reportPath) {
+            reportPath = argv[++i];
+        } else if (argv[i][0] != '-') {
+            files[numFiles++].path = argv[i];
+        } else {
+            printUsage(argv[0]);
+            free(files);
+            return 1;
+        }
+    }
+
+    if (!numFiles) {
+        printUsage(argv[0]);
+        free(files);
         return 1;
     }
 
-    regex_t regex[numRules] = { 0 };
+    if (numShards > 1) {
+        numFiles = shardFiles(files, numFiles, shard, numShards);
 
-    for (int i = 0; i < numRules; ++i) {
-        int status = regcomp(regex + i, patterns[i], REG_EXTENDED | REG_ICASE);
-        if (status) {
-            fprintf(stderr, "regex %d failed to compile:\n", i);
-            printError(status, regex + i);
-            cleanup(input, output, regex);
+        if (numFiles < 0) {
+            fprintf(stderr, "failed to allocate shards\n");
+            free(files);
             return 1;
         }
     }
 
-    indentionSize = strlen(indention);
-    int insidePreformattedBlock = 0;
-    int lineNum = 0;
-    int prevLineBlank = 0;
+    int explicitConfig = config != NULL;
+    if (!explicitConfig) {
+        config = defaultConfig;
+    }
+
+    size_t size;
+    char * cfg = readFile(config, &size);
+    if (!cfg && explicitConfig) {
+        fprintf(stderr, "failed to open config file: %s\n", config);
+        free(files);
+        return 1;
+    }
 
-    while (fgets(source, 4096, input)) {
-        ++lineNum;
-        int skip = insidePreformattedBlock;
+    long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numWorkers > numFiles) {
+        numWorkers = numFiles;
+    }
 
-        if (!skip && strstr(source, preformatted)) {
-            skip = 1;
-        }
+    // each worker runs two assemblers under --verify, so it asks for a job slot for each
+    int verifying = verify && !checkOnly;
+    jobserver_t jobserver;
+    int numSlots = jobserverClaim(&jobserver, verifying ? numWorkers * 2 : numWorkers);
+    numWorkers = verifying && numSlots > 1 ? numSlots / 2 : numSlots;
+
+    formatter_t formatter;
+    formatter.contexts = calloc(numWorkers, sizeof(caddy65_t *));
+    formatter.stats = calloc(numWorkers, sizeof(caddy65_stats_t));
+    formatter.files = files;
+    formatter.changedLines = calloc(numFiles + 1, sizeof(size_t));
+    formatter.verifier = NULL;
+    formatter.checkOnly = checkOnly;
+
+    int failed = !formatter.contexts || !formatter.stats || !formatter.changedLines;
+
+    // the config is read once, so its warnings are not repeated for every worker
+    for (int i = 0; !failed && i < numWorkers; ++i) {
+        formatter.contexts[i] = i ? caddy65Copy(formatter.contexts[0]) : caddy65Create(cfg);
+        failed = !formatter.contexts[i];
+    }
 
-        if (strstr(source, preformattedStart)) {
-            ++insidePreformattedBlock;
-            skip = 1;
-        }
+    free(cfg);
 
-        if (strstr(source, preformattedEnd)) {
-            if (!insidePreformattedBlock) {
-                printf("%s command on line %d is not inside a preformatted block: ignoring\n",
-                    preformattedEnd, lineNum);
-            } else {
-                --insidePreformattedBlock;
-            }
+    if (!failed && verifying) {
+        const char * assembler = getenv("CA65");
+        formatter.verifier = verifierCreate(assembler ? assembler : "ca65", verifyCache, numSlots > 1);
 
-            skip = 1;
+        if (!formatter.verifier) {
+            fprintf(stderr, "failed to allocate verifier\n");
+            failed = 1;
         }
+    } else if (failed) {
+        fprintf(stderr, "failed to read config file: %s\n", config);
+    }
 
-        if (skip) {
-            printLineResult(output, source, 0, 1);
-            prevLineBlank = 0;
-            continue;
-        }
+    for (int i = 0; !failed && blocks && i < numWorkers; ++i) {
+        failed = caddy65UseBlocks(formatter.contexts[i], 1) != caddy65Success;
+    }
 
-        flags_t flags = prependIndention;
+    includes_t includes = { NULL, 0, PTHREAD_MUTEX_INITIALIZER };
+    formatter.includes = followIncludes ? &includes : NULL;
+    formatter.useMacros = useMacros;
 
-        char * c = strchr(source, '\n');
-        if (c) {
-            flags |= appendNewline;
-            *c = '\0';
-        }
+    if (!failed) {
+        failed = runBatch(files, numFiles, numWorkers, formatSource, &formatter);
+        jobserverRelease(&jobserver);
 
-        for (int i = 0; i < numRules; ++i) {
-            if (!(enabled & (1u << i))) {
-                continue;
-            }
+        if (reportPath && writeReport(reportPath, &formatter, numFiles)) {
+            failed = 1;
+        }
+    }
 
-            result_t result = applyRule(i, source, flags, regex + i);
-            if (result == error) {
-                cleanup(input, output, regex);
-                return 1;
-            }
+    jobserverRelease(&jobserver);
 
-            switch (i) {
-                case onlyComment: {
-                    if (result == compliant || result == applied) {
-                        if (*source == ';') {
-                            flags &= ~prependIndention;
-                        } else {
-                            flags |= prependIndention;
-                        }
-                    }
-                    break;
-                }
-                case trimTrailing: {
-                    if (!*source) {
-                        if (prevLineBlank) {
-                            flags |= omit;
-                        } else {
-                            prevLineBlank = 1;
-                            flags &= ~prependIndention;
-                            flags |= done;
-                        }
-                    } else {
-                        prevLineBlank = 0;
-                    }
-                    break;
-                }
-                case bitwiseInstruction: {
-                    if (result == compliant || result == applied) {
-                        flags |= bitwiseOperation;
-                    }
-                    break;
-                }
-                case controlCommand: {
-                    if ((result == compliant || result == applied) && *source != ';') {
-                        if (strncmp(source + 1, "asciiz",  6) == 0 ||
-                            strncmp(source + 1, "addr",    4) == 0 ||
-                            strncmp(source + 1, "byt",     3) == 0 ||
-                            strncmp(source + 1, "byte",    4) == 0 ||
-                            strncmp(source + 1, "dbyt",    4) == 0 ||
-                            strncmp(source + 1, "dword",   5) == 0 ||
-                            strncmp(source + 1, "lobytes", 7) == 0 ||
-                            strncmp(source + 1, "hibytes", 7) == 0 ||
-                            strncmp(source + 1, "word",    4) == 0) {
-
-                            flags |= prependIndention;
-                        } else {
-                            flags &= ~prependIndention;
-                        }
-                    }
-                    break;
-                }
-                case namedLabel: {
-                    if (result == compliant || result == applied) {
-                        flags &= ~prependIndention;
-                    }
-                    break;
-                }
-                case unnamedLabel: {
-                    if (result == compliant || result == applied) {
-                        flags |= prependLabel;
-                    }
-                    break;
-                }
-                case macroInstance:
-                case impliedInstruction:
-                case immediateInstruction:
-                case addressInstruction:
-                case indexedInstruction:
-                case indirectInstruction:
-                case indirectXInstruction:
-                case indirectYInstruction:
-                case relativeInstruction: {
-                    if (result == compliant || result == applied) {
-                        flags |= prependIndention;
-                    }
-                    break;
-                }
-                default: {
-                    break;
-                }
-            }
+    if (verifierFree(formatter.verifier)) {
+        failed = 1;
+    }
 
-            printRuleResult(i, result, flags);
+    int unformatted = 0;
 
-            if (flags & (done | omit)) {
-                break;
-            }
+    for (int i = 0; checkOnly && i < numFiles; ++i) {
+        if (formatter.changedLines[i]) {
+            printf("%s: %zu lines need formatting\n", files[i].path, formatter.changedLines[i]);
+            unformatted = 1;
         }
+    }
+
+    caddy65_stats_t total = { 0 };
+
+    for (int i = 0; formatter.contexts && formatter.stats && i < numWorkers; ++i) {
+        total.lines += formatter.stats[i].lines;
+        total.preformattedLines += formatter.stats[i].preformattedLines;
+        total.changedLines += formatter.stats[i].changedLines;
+        total.cacheHits += formatter.stats[i].cacheHits;
+        total.cacheMisses += formatter.stats[i].cacheMisses;
+    }
 
-        printLineResult(output, source, flags, 0);
+    for (int i = 0; formatter.contexts && i < numWorkers; ++i) {
+        caddy65Free(formatter.contexts[i]);
     }
 
-    cleanup(input, output, regex);
+    freeIncludes(&includes);
 
-    if (rename(temp, sourceCode)) {
-        fprintf(stderr, "failed to rename temporary file\n");
-        return 1;
+    if (printStats) {
+        size_t lookups = total.cacheHits + total.cacheMisses;
+        printf("files: %d, lines: %zu, preformatted: %zu, changed: %zu, cache hits: %zu/%zu (%.1f%%)\n",
+            numFiles, total.lines, total.preformattedLines, total.changedLines, total.cacheHits, lookups,
+            lookups ? 100.0 * total.cacheHits / lookups : 0.0);
     }
 
-    return 0;
-}
\ No newline at end of file
+    free(formatter.contexts);
+    free(formatter.stats);
+    free(formatter.changedLines);
+    free(files);
+    return failed || unformatted ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#ifndef CADDY65_H
+#define CADDY65_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libcaddy65: reentrant formatter for ca65-compatible 6502 assembly.
+ *
+ * Each context owns its compiled rules, scratch space and per-file state, so
+ * separate contexts may be used concurrently from separate threads.
+ */
+
+typedef struct caddy65 caddy65_t;
+typedef struct caddy65_macros caddy65_macros_t;
+
+typedef enum {
+    caddy65Success,
+    caddy65Error,
+    caddy65Overflow,
+} caddy65_status_t;
+
+typedef struct {
+    size_t lines;
+    size_t preformattedLines;
+    size_t changedLines;
+    size_t cacheHits;
+    size_t cacheMisses;
+} caddy65_stats_t;
+
+/*
+ * Called by caddy65MacrosScan for each .include directive, with the path as
+ * written in the source. Implementations typically read the file and pass it
+ * back to caddy65MacrosScan.
+ */
+typedef caddy65_status_t (* caddy65_include_t)(caddy65_macros_t * macros, const char * path, void * user);
+
+/*
+ * Creates a context from the contents of a caddy65.cfg file.
+ * A NULL config enables all rules.
+ * Rules are compiled the first time they are needed, so a rule that fails to
+ * compile is reported as an error by the formatting functions.
+ * Returns NULL if the config cannot be parsed.
+ */
+caddy65_t * caddy65Create(const char * config);
+
+/*
+ * Creates a context with the same rules as ctx, without reading the config
+ * again. Per-file state, statistics, and settings such as blocks are not
+ * copied.
+ * Returns NULL if the context cannot be allocated.
+ */
+caddy65_t * caddy65Copy(const caddy65_t * ctx);
+
+/*
+ * Releases all resources held by the context.
+ */
+void caddy65Free(caddy65_t * ctx);
+
+/*
+ * Creates an empty index of macro names.
+ */
+caddy65_macros_t * caddy65MacrosCreate(void);
+
+/*
+ * Adds the names of all .macro definitions found in the source to the index.
+ * If include is not NULL, it is called for each .include directive.
+ */
+caddy65_status_t caddy65MacrosScan(caddy65_macros_t * macros, const char * input, size_t inputSize,
+    caddy65_include_t include, void * user);
+
+/*
+ * Adds the names in other to the index, such as those from an earlier scan
+ * of an included file. Other is only read.
+ */
+caddy65_status_t caddy65MacrosMerge(caddy65_macros_t * macros, const caddy65_macros_t * other);
+
+/*
+ * Releases the index. It must no longer be in use by any context.
+ */
+void caddy65MacrosFree(caddy65_macros_t * macros);
+
+/*
+ * Classifies macro instances by looking up the leading symbol in the index
+ * rather than treating every symbol-led line as a macro instance.
+ * The index is only read, so it may be shared by contexts on other threads.
+ * A NULL index restores the default behavior.
+ */
+void caddy65UseMacros(caddy65_t * ctx, const caddy65_macros_t * macros);
+
+/*
+ * Makes caddy65FormatBuffer read blocks of lines and apply each rule to the
+ * whole block before moving to the next rule, rather than taking each line
+ * through every rule in turn. The output is identical, and so are the
+ * statistics, except for cache hits following a call that did not succeed.
+ * Blocks take about a megabyte per context.
+ * Returns caddy65Error if the block buffers cannot be allocated.
+ */
+caddy65_status_t caddy65UseBlocks(caddy65_t * ctx, int enable);
+
+/*
+ * Retrieves statistics accumulated over the lifetime of the context.
+ * Repeated short lines are served from a cache of formatted output, which is
+ * reflected in cacheHits and cacheMisses.
+ */
+void caddy65Stats(const caddy65_t * ctx, caddy65_stats_t * stats);
+
+/*
+ * Forgets per-file state, such as open preformatted blocks and blank line
+ * tracking, so the context may be reused for another file.
+ */
+void caddy65Reset(caddy65_t * ctx);
+
+/*
+ * Formats a single source line, including its trailing newline if present.
+ * State carries over from previously formatted lines until caddy65Reset.
+ * The line must not exceed 4095 characters.
+ * On success, the null-terminated result is stored in output and its length,
+ * which may be zero for omitted lines, is stored in outputLength.
+ * Returns caddy65Overflow if outputSize is too small.
+ */
+caddy65_status_t caddy65FormatLine(caddy65_t * ctx, const char * line, size_t lineSize,
+    char * output, size_t outputSize, size_t * outputLength);
+
+/*
+ * Formats an entire source file held in memory.
+ * The context is reset before formatting begins.
+ * On success, the null-terminated result is stored in output and its length
+ * is stored in outputLength.
+ * Returns caddy65Overflow if outputSize is too small.
+ */
+caddy65_status_t caddy65FormatBuffer(caddy65_t * ctx, const char * input, size_t inputSize,
+    char * output, size_t outputSize, size_t * outputLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+
+static int isOpen(int fd) {
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+static int openAuth(jobserver_t * jobserver, const char * auth, size_t len) {
+    char buffer[4096];
+
+    if (len >= sizeof(buffer)) {
+        return 1;
+    }
+
+    memcpy(buffer, auth, len);
+    buffer[len] = '\0';
+
+    if (strncmp(buffer, "fifo:", 5) == 0) {
+        jobserver->readFd = open(buffer + 5, O_RDONLY | O_NONBLOCK);
+        jobserver->writeFd = jobserver->readFd < 0 ? -1 : open(buffer + 5, O_WRONLY);
+        jobserver->closeRead = jobserver->closeWrite = 1;
+        return jobserver->writeFd < 0;
+    }
+
+    int readFd;
+    int writeFd;
+
+    // make leaves the pipe out of recipes not marked as recursive
+    if (sscanf(buffer, "%d,%d", &readFd, &writeFd) != 2 || !isOpen(readFd) || !isOpen(writeFd)) {
+        return 1;
+    }
+
+    jobserver->writeFd = writeFd;
+
+#ifdef __linux__
+    // reopening the pipe gives a private description, so O_NONBLOCK cannot affect make
+    snprintf(buffer, sizeof(buffer), "/proc/self/fd/%d", readFd);
+    jobserver->readFd = open(buffer, O_RDONLY | O_NONBLOCK);
+    jobserver->closeRead = jobserver->readFd >= 0;
+#endif
+
+    if (jobserver->readFd < 0) {
+        jobserver->readFd = readFd;
+    }
+
+    return 0;
+}
+
+// reads one token without blocking, returning 1 on success
+static int takeToken(jobserver_t * jobserver, char * token) {
+    // descriptions opened here are nonblocking, but make's own pipe may not be
+    if (!jobserver->closeRead) {
+        struct pollfd fd = { jobserver->readFd, POLLIN, 0 };
+
+        // another client may still win the token between poll and read
+        if (poll(&fd, 1, 0) != 1 || !(fd.revents & POLLIN)) {
+            return 0;
+        }
+    }
+
+    ssize_t len;
+    do {
+        len = read(jobserver->readFd, token, 1);
+    } while (len < 0 && errno == EINTR);
+
+    return len == 1;
+}
+
+int jobserverClaim(jobserver_t * jobserver, int wanted) {
+    jobserver->readFd = jobserver->writeFd = -1;
+    jobserver->closeRead = jobserver->closeWrite = 0;
+    jobserver->numTokens = 0;
+    jobserver->tokens = NULL;
+
+    const char * flags = getenv("MAKEFLAGS");
+    const char * auth = NULL;
+    size_t authLen = 0;
+    long jobs = 0;
+
+    while (flags && *flags) {
+        while (*flags == ' ') {
+            ++flags;
+        }
+
+        size_t len = strcspn(flags, " ");
+
+        if (strncmp(flags, "--jobserver-auth=", 17) == 0) {
+            auth = flags + 17;
+            authLen = len - 17;
+        } else if (strncmp(flags, "--jobserver-fds=", 16) == 0) {
+            auth = flags + 16;
+            authLen = len - 16;
+        } else if (strncmp(flags, "-j", 2) == 0) {
+            jobs = strtol(flags + 2, NULL, 10);
+        }
+
+        flags += len;
+    }
+
+    if (wanted < 1) {
+        wanted = 1;
+    }
+
+    if (auth && !openAuth(jobserver, auth, authLen)) {
+        jobserver->tokens = malloc(wanted);
+
+        while (jobserver->tokens && jobserver->numTokens < wanted - 1 &&
+            takeToken(jobserver, jobserver->tokens + jobserver->numTokens)) {
+
+            ++jobserver->numTokens;
+        }
+
+        return 1 + jobserver->numTokens;
+    }
+
+    jobserverRelease(jobserver);
+    return jobs > 0 && jobs < wanted ? jobs : wanted;
+}
+
+void jobserverRelease(jobserver_t * jobserver) {
+    for (int i = 0; i < jobserver->numTokens; ++i) {
+        ssize_t len;
+        do {
+            len = write(jobserver->writeFd, jobserver->tokens + i, 1);
+        } while (len < 0 && errno == EINTR);
+
+        if (len != 1) {
+            fprintf(stderr, "failed to return job token: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    if (jobserver->closeRead && jobserver->readFd >= 0) {
+        close(jobserver->readFd);
+    }
+
+    if (jobserver->closeWrite && jobserver->writeFd >= 0) {
+        close(jobserver->writeFd);
+    }
+
+    free(jobserver->tokens);
+    jobserver->readFd = jobserver->writeFd = -1;
+    jobserver->closeRead = jobserver->closeWrite = 0;
+    jobserver->numTokens = 0;
+    jobserver->tokens = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+/*
+ * GNU make jobserver client for the caddy65 command line tool.
+ *
+ * When run from a parallel make, caddy65 holds one job token for each worker
+ * thread beyond the first, or under --verify for each assembler it runs, so
+ * the build as a whole stays within make's -j limit. Both the fifo and pipe forms of --jobserver-auth are understood.
+ */
+
+typedef struct {
+    int readFd;
+    int writeFd;
+    int closeRead;
+    int closeWrite;
+    int numTokens;
+    char * tokens;
+} jobserver_t;
+
+/*
+ * Returns how many jobs, between 1 and wanted, may run.
+ * Under a jobserver, takes whatever tokens are free without waiting.
+ * Otherwise honors -jN from MAKEFLAGS, if present.
+ */
+int jobserverClaim(jobserver_t * jobserver, int wanted);
+
+/*
+ * Returns the tokens taken by jobserverClaim.
+ */
+void jobserverRelease(jobserver_t * jobserver);
+
+#endif
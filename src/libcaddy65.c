@@ -0,0 +1,1932 @@
+#include <ctype.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "caddy65.h"
+#include "rules.h"
+#include "matchers.h"
+
+#if defined(__has_include) && !defined(CADDY65_NO_SDT)
+#if __has_include(<sys/sdt.h>)
+#define useSdt 1
+#include <sys/sdt.h>
+#endif
+#endif
+
+// static probes for perf and bpftrace, a single nop each when not attached
+#ifdef useSdt
+#define trace2(name, a, b) DTRACE_PROBE2(caddy65, name, a, b)
+#define trace3(name, a, b, c) DTRACE_PROBE3(caddy65, name, a, b, c)
+#else
+#define trace2(name, a, b)
+#define trace3(name, a, b, c)
+#endif
+
+static const char * const indention = "  ";
+static const char * const preformatted = "#pre-formatted";
+static const char * const preformattedStart = "#pre-formatted-start";
+static const char * const preformattedEnd = "#pre-formatted-end";
+
+static const int verbose = 0;
+static const int pedantic = 0;
+
+#define matchLength(n) (match[n].rm_eo - match[n].rm_so)
+
+#ifdef enabledRules
+#define isEnabled(ctx, rule) (enabledRules & (1u << (rule)))
+#else
+#define isEnabled(ctx, rule) ((ctx)->enabled & (1u << (rule)))
+#endif
+
+typedef enum {
+    appendNewline = 1 << 0,
+    prependIndention = 1 << 1,
+    prependLabel = 1 << 2,
+    bitwiseOperation = 1 << 3,
+    done = 1 << 4,
+    omit = 1 << 5,
+} flags_t;
+
+typedef enum {
+    notApplied,
+    compliant,
+    applied,
+    error,
+} result_t;
+
+static const char * resultNames[] = {
+    "notApplied",
+    "compliant",
+    "applied",
+    "error",
+};
+
+#define cacheSize 1024
+#define cacheLineSize 96
+#define cacheOutputSize 128
+
+typedef struct {
+    uint64_t hash;
+    uint64_t macros;
+    uint8_t valid;
+    uint8_t prevLineBlank;
+    uint8_t nextLineBlank;
+    uint8_t lineSize;
+    uint8_t outputSize;
+    char line[cacheLineSize];
+    char output[cacheOutputSize];
+} cacheEntry_t;
+
+#define blockLines 256
+
+typedef enum {
+    lineActive,
+    lineFinished,
+    linePreformatted,
+    lineCached,
+    lineRepeated,
+} lineState_t;
+
+// per-line state of a block, laid out so each rule pass walks it in order
+typedef struct {
+    const char * input[blockLines];
+    uint64_t hash[blockLines];
+    size_t outputStart[blockLines];
+    size_t outputLength[blockLines];
+    uint16_t inputSize[blockLines];
+    int16_t owner[blockLines];
+    uint8_t state[blockLines];
+    uint8_t flags[blockLines];
+    uint8_t prevLineBlank[blockLines];
+    uint8_t nextLineBlank[blockLines];
+    int16_t slotOwner[cacheSize];
+    char source[blockLines][4096];
+} block_t;
+
+struct caddy65_macros {
+    char ** names;
+    size_t capacity;
+    size_t count;
+    uint64_t digest;
+};
+
+struct caddy65 {
+    regex_t regex[numRules];
+    const caddy65_macros_t * macros;
+    uint32_t enabled;
+    uint32_t compiled;
+    int indentionSize;
+    int insidePreformattedBlock;
+    int lineNum;
+    int prevLineBlank;
+    caddy65_stats_t stats;
+    block_t * block;
+    cacheEntry_t cache[cacheSize];
+    char source[4096];
+    char scratch[4096];
+    unsigned short starts[4097];
+};
+
+static void printError(caddy65_t * ctx, int errorCode, regex_t * regex) {
+    regerror(errorCode, regex, ctx->scratch, 4096);
+    fprintf(stderr, "%s\n", ctx->scratch);
+}
+
+static caddy65_status_t printLineResult(caddy65_t * ctx, const char * source, char * output,
+    size_t outputSize, size_t * outputLength, flags_t flags, int skipped) {
+
+    int len = strlen(source);
+    int written = 0;
+
+    if (!outputSize) {
+        return caddy65Overflow;
+    }
+
+    if (skipped) {
+        if (verbose) {
+            printf("preformatted:\n%s", source);
+        }
+        written = snprintf(output, outputSize, "%s", source);
+    } else if (flags & omit) {
+        if (verbose) {
+            printf("<omitted blank line>\n");
+        }
+        *output = '\0';
+    } else {
+        const char * prefix = flags & prependLabel ? ":" : "";
+        int prefixSize = flags & prependLabel ? ctx->indentionSize - 1 : ctx->indentionSize;
+        const char * indent = len && flags & (prependLabel | prependIndention) ? indention : "";
+
+        if (verbose) {
+            printf("\"%s%.*s%s\"\n", prefix, prefixSize, indent, source);
+        }
+
+        written = snprintf(output, outputSize, "%s%.*s%s%s",
+            prefix,
+            prefixSize, indent,
+            source,
+            flags & appendNewline ? "\n" : "");
+    }
+
+    if (written < 0 || (size_t) written >= outputSize) {
+        return caddy65Overflow;
+    }
+
+    *outputLength = written;
+    return caddy65Success;
+}
+
+static void printRuleResult(rule_t rule, result_t result, flags_t flags) {
+    if (pedantic) {
+        printf("%24.24s: %10.10s, flags: %d\n", ruleNames[rule], resultNames[result], flags);
+    }
+}
+
+// runs the reverse matcher from the end of the line back to start, leaving its state at each position
+static void scanStarts(rule_t rule, const char * source, size_t start, size_t end, unsigned short * starts) {
+    const matcher_t * matcher = reverseMatchers + rule;
+    const int n = matcher->numClasses;
+    unsigned state = matcher->next[n + matcher->classes[257]];
+
+    starts[end] = state;
+
+    for (size_t p = end; p > start; --p) {
+        state = matcher->next[state * n + matcher->classes[(unsigned char) source[p - 1]]];
+        starts[p - 1] = state;
+    }
+}
+
+static int startsMatch(rule_t rule, const unsigned short * starts, size_t p) {
+    const matcher_t * matcher = reverseMatchers + rule;
+    unsigned state = starts[p];
+
+    // a match from the first character may also begin with '^'
+    return matcher->accept[state] ||
+        (!p && matcher->accept[matcher->next[state * matcher->numClasses + matcher->classes[256]]]);
+}
+
+// returns the end of the longest match from start, or -1 if there is none
+static long matchEnd(rule_t rule, const char * source, size_t start, size_t end) {
+    const matcher_t * matcher = forwardMatchers + rule;
+    const int n = matcher->numClasses;
+    unsigned state = 1;
+
+    if (!start) {
+        state = matcher->next[n + matcher->classes[256]];
+    }
+
+    long last = matcher->accept[state] ? (long) start : -1;
+
+    for (size_t p = start; state && p < end; ++p) {
+        state = matcher->next[state * n + matcher->classes[(unsigned char) source[p]]];
+
+        if (matcher->accept[state]) {
+            last = p + 1;
+        }
+    }
+
+    if (state && matcher->accept[matcher->next[state * n + matcher->classes[257]]]) {
+        last = end;
+    }
+
+    return last;
+}
+
+static int rewrite(caddy65_t * ctx, char * const source, const char * format, ...) {
+    // every line buffer holds 4096 characters
+    size_t room = sizeof(ctx->source);
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(ctx->scratch, room, format, args);
+    va_end(args);
+
+    if (len < 0 || (size_t) len >= room) {
+        fprintf(stderr, "formatted line %d exceeds 4095 characters\n", ctx->lineNum);
+        return 1;
+    }
+
+    memcpy(source, ctx->scratch, len + 1);
+    return 0;
+}
+
+static int isSymbolStart(char c) {
+    return c == '_' || isalpha((unsigned char) c);
+}
+
+static int isSymbolChar(char c) {
+    return c == '_' || isalnum((unsigned char) c);
+}
+
+static size_t symbolLength(const char * source, size_t len) {
+    size_t n = 0;
+
+    if (len && isSymbolStart(source[0])) {
+        n = 1;
+
+        while (n < len) {
+            if (isSymbolChar(source[n])) {
+                ++n;
+            } else if (n + 1 < len && source[n] == ':' && source[n + 1] == ':') {
+                n += 2;
+            } else {
+                break;
+            }
+        }
+    }
+
+    return n;
+}
+
+static uint64_t hashName(const char * name, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t) name[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static char ** findMacro(char ** names, size_t capacity, const char * name, size_t len) {
+    size_t i = hashName(name, len) & (capacity - 1);
+
+    while (names[i] && (strncmp(names[i], name, len) || names[i][len])) {
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return names + i;
+}
+
+static int addMacro(caddy65_macros_t * macros, const char * name, size_t len) {
+    if ((macros->count + 1) * 2 > macros->capacity) {
+        size_t capacity = macros->capacity ? macros->capacity * 2 : 64;
+        char ** names = calloc(capacity, sizeof(char *));
+        if (!names) {
+            return 1;
+        }
+
+        for (size_t i = 0; i < macros->capacity; ++i) {
+            if (macros->names[i]) {
+                *findMacro(names, capacity, macros->names[i], strlen(macros->names[i])) = macros->names[i];
+            }
+        }
+
+        free(macros->names);
+        macros->names = names;
+        macros->capacity = capacity;
+    }
+
+    char ** slot = findMacro(macros->names, macros->capacity, name, len);
+    if (!*slot) {
+        *slot = malloc(len + 1);
+        if (!*slot) {
+            return 1;
+        }
+
+        memcpy(*slot, name, len);
+        (*slot)[len] = '\0';
+        ++macros->count;
+
+        // order independent, so identical sets of macros share cached lines
+        uint64_t hash = hashName(name, len);
+        macros->digest += (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9ull;
+    }
+
+    return 0;
+}
+
+static const char * skipSpace(const char * c, const char * end) {
+    while (c < end && (*c == ' ' || *c == '\t')) {
+        ++c;
+    }
+
+    return c;
+}
+
+static const char * matchCommand(const char * c, const char * end, const char * command) {
+    size_t len = strlen(command);
+
+    if ((size_t) (end - c) < len + 1 || *c != '.' || strncasecmp(c + 1, command, len)) {
+        return NULL;
+    }
+
+    c += len + 1;
+    return c < end && (*c == ' ' || *c == '\t') ? skipSpace(c, end) : NULL;
+}
+
+static int isMnemonic(const char * source, size_t len) {
+    if (len != 3) {
+        return 0;
+    }
+
+    // the instruction pattern lists each mnemonic as "|xyz" or "(xyz"
+    for (const char * c = instruction; (c = strpbrk(c, "(|")); ++c) {
+        if (strncasecmp(c + 1, source, 3) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int matchMacro(const caddy65_macros_t * macros, const char * source, regmatch_t * match) {
+    size_t len = strlen(source);
+    size_t n = symbolLength(source, len);
+
+    if (!n) {
+        return REG_NOMATCH;
+    }
+
+    // instructions with symbolic operands share the macro instance layout
+    if (!isMnemonic(source, n) &&
+        (!macros->capacity || !*findMacro(macros->names, macros->capacity, source, n))) {
+        return REG_NOMATCH;
+    }
+
+    size_t ws = n;
+    while (isspace((unsigned char) source[ws])) {
+        ++ws;
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        match[i].rm_so = match[i].rm_eo = -1;
+    }
+
+    match[0].rm_so = match[1].rm_so = 0;
+    match[1].rm_eo = n;
+
+    if (!source[n]) {
+        match[0].rm_eo = match[4].rm_so = match[4].rm_eo = n;
+        return 0;
+    }
+
+    if (ws == n || !source[ws] || (!strchr("$%\"_", source[ws]) && !isalnum((unsigned char) source[ws]))) {
+        return REG_NOMATCH;
+    }
+
+    match[4].rm_so = match[5].rm_so = match[6].rm_so = n;
+    match[6].rm_eo = match[7].rm_so = ws;
+    match[0].rm_eo = match[4].rm_eo = match[5].rm_eo = match[7].rm_eo = ws + 1;
+    return 0;
+}
+
+static void printMatchError(caddy65_t * ctx, rule_t rule, const char * source, int status) {
+    if (ctx->compiled & (1u << rule)) {
+        fprintf(stderr, "\"%s\" failed to match (%d):\n", ruleNames[rule], status);
+        fprintf(stderr, "string: %s\n", source);
+    } else {
+        fprintf(stderr, "\"%s\" failed to compile (%d):\n", ruleNames[rule], status);
+    }
+
+    fprintf(stderr, "pattern: %s\n", patterns[rule]);
+    printError(ctx, status, ctx->regex + rule);
+}
+
+/*
+ * Offsets in match are relative to source, even when searching from start.
+ * The matchers find where the match starts and ends, so regexec only has to
+ * fill in the subexpressions. Match may be NULL if those are not needed.
+ * Scanned is nonzero when ctx->starts already holds this line's reverse scan.
+ */
+static int findMatch(caddy65_t * ctx, rule_t rule, const char * source, size_t start, size_t end,
+    regmatch_t * match, int scanned) {
+
+    size_t first = start;
+
+    if (anchoredRules & (1u << rule)) {
+        if (start) {
+            return REG_NOMATCH;
+        }
+    } else {
+        if (!scanned) {
+            scanStarts(rule, source, start, end, ctx->starts);
+        }
+
+        while (first <= end && !startsMatch(rule, ctx->starts, first)) {
+            ++first;
+        }
+
+        if (first > end) {
+            return REG_NOMATCH;
+        }
+    }
+
+    long last = matchEnd(rule, source, first, end);
+
+    if (last < 0) {
+        return REG_NOMATCH;
+    }
+
+    if (!match) {
+        return 0;
+    }
+
+    // rules are compiled on first use, so lines the matchers reject cost nothing
+    if (!(ctx->compiled & (1u << rule))) {
+        int status = regcomp(ctx->regex + rule, patterns[rule], REG_EXTENDED | REG_ICASE);
+        if (status) {
+            return status;
+        }
+
+        ctx->compiled |= 1u << rule;
+    }
+
+#ifdef REG_STARTEND
+    // '$' can only match at the end of the line, which may be outside the window
+    match[0].rm_so = first;
+    match[0].rm_eo = last;
+    return regexec(ctx->regex + rule, source, 16, match, REG_STARTEND | ((size_t) last < end ? REG_NOTEOL : 0));
+#else
+    int status = regexec(ctx->regex + rule, source + first, 16, match, first ? REG_NOTBOL : 0);
+
+    for (int i = 0; !status && i < 16; ++i) {
+        if (match[i].rm_so >= 0) {
+            match[i].rm_so += first;
+            match[i].rm_eo += first;
+        }
+    }
+
+    return status;
+#endif
+}
+
+static void emit(caddy65_t * ctx, size_t * length, const char * text, size_t size) {
+    if (*length + size < sizeof(ctx->scratch)) {
+        memcpy(ctx->scratch + *length, text, size);
+    }
+
+    *length += size;
+}
+
+static size_t atMost(size_t offset, size_t end) {
+    return offset < end ? offset : end;
+}
+
+/*
+ * The spacing-led rules are found from the character they space, walking back
+ * over the space before it, rather than trying the pattern at every space.
+ * The submatches are filled in as regexec would, with the character itself as
+ * the second one for byteOperatorFormatting.
+ */
+static int findSpaced(rule_t rule, const char * source, size_t start, size_t end, regmatch_t * match) {
+    const char * c = source + start;
+    size_t width = 1;
+
+    switch (rule) {
+        case openParenSpacing: {
+            c = strchr(c, '(');
+            break;
+        }
+        case closeParenSpacing: {
+            c = strchr(c, ')');
+            break;
+        }
+        case commaSpacing: {
+            c = strchr(c, ',');
+            break;
+        }
+        case byteOperatorFormatting: {
+            while ((c = strchr(c, '#')) && c[1] != '<' && c[1] != '>') {
+                ++c;
+            }
+            width = 2;
+            break;
+        }
+        default: {
+            return REG_BADPAT;
+        }
+    }
+
+    if (!c || (size_t) (c - source) + width > end) {
+        return REG_NOMATCH;
+    }
+
+    size_t at = c - source;
+    size_t before = at;
+    size_t after = at + width;
+    int group = 1;
+
+    while (before > start && isspace((unsigned char) source[before - 1])) {
+        --before;
+    }
+
+    while (after < end && isspace((unsigned char) source[after])) {
+        ++after;
+    }
+
+    match[0].rm_so = before;
+    match[0].rm_eo = after;
+    match[group].rm_so = before;
+    match[group++].rm_eo = at;
+
+    if (width > 1) {
+        match[group].rm_so = at;
+        match[group++].rm_eo = at + width;
+    }
+
+    match[group].rm_so = at + width;
+    match[group].rm_eo = after;
+    return 0;
+}
+
+/*
+ * Applies a rule at every match in the line, scanning left to right.
+ * Source before copied has already been emitted to scratch, so each match
+ * only costs its own length and the line is replaced once at the end.
+ * Searches resume at cursor, which is never behind copied.
+ */
+static result_t applyRepeatedRule(caddy65_t * ctx, rule_t rule, char * const source, const flags_t flags) {
+    regmatch_t match[16];
+    result_t result = notApplied;
+    const size_t end = strlen(source);
+    size_t cursor = 0;
+    size_t copied = 0;
+    size_t length = 0;
+    int scanning = 1;
+    int status;
+
+    const char * c = strchr(source, ';');
+    size_t commentStart = c ? (size_t) (c - source) : end + 1;
+
+    const int spaced = rule == openParenSpacing || rule == closeParenSpacing ||
+        rule == byteOperatorFormatting || rule == commaSpacing;
+
+    // the line is scanned once, since the other rules only change the case of what they match
+    if (!spaced) {
+        scanStarts(rule, source, 0, end, ctx->starts);
+    }
+
+    while (scanning && !(status = spaced ?
+        findSpaced(rule, source, cursor, end, match) : findMatch(ctx, rule, source, cursor, end, match, 1))) {
+
+        size_t start = match[0].rm_so;
+        result_t found = compliant;
+
+        if (commentStart < cursor) {
+            c = strchr(source + cursor, ';');
+            commentStart = c ? (size_t) (c - source) : end + 1;
+        }
+
+        switch (rule) {
+            case tabExpansion: {
+                emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                emit(ctx, &length, indention, ctx->indentionSize);
+                copied = cursor = match[1].rm_eo;
+                found = applied;
+                break;
+            }
+            case addressFormatting: {
+                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
+                    if (isupper(source[i])) {
+                        source[i] = tolower(source[i]);
+                        found = applied;
+                    }
+                }
+
+                int s1 = matchLength(1);
+                if (s1 & 1) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, "0", 1);
+                    copied = match[1].rm_so;
+                    found = applied;
+                }
+
+                cursor = match[1].rm_so;
+                break;
+            }
+            case hexLiteralFormatting: {
+                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
+                    if (isupper(source[i])) {
+                        source[i] = tolower(source[i]);
+                        found = applied;
+                    }
+                }
+
+                size_t offset = match[1].rm_so;
+
+                if (flags & bitwiseOperation) {
+                    int s1 = matchLength(1);
+
+                    if (s1 & 1) {
+                        emit(ctx, &length, source + copied, offset - copied);
+                        emit(ctx, &length, "0", 1);
+                        copied = offset;
+                        found = applied;
+                    }
+                } else {
+                    while (source[offset] == '0' && isxdigit(source[offset + 1])) {
+                        ++offset;
+                    }
+
+                    if (offset != (size_t) match[1].rm_so) {
+                        emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                        copied = offset;
+                        found = applied;
+                    }
+                }
+
+                cursor = offset;
+                break;
+            }
+            case binaryLiteralFormatting: {
+                int s1 = matchLength(1);
+
+                if (s1 != 8) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, "00000000", 8 - s1);
+                    copied = match[1].rm_so;
+                    found = applied;
+                }
+
+                cursor = match[1].rm_so;
+                break;
+            }
+            case openParenSpacing:
+            case closeParenSpacing: {
+                if (start >= commentStart) {
+                    scanning = 0;
+                    break;
+                }
+
+                int s1 = matchLength(1);
+                int s2 = matchLength(2);
+
+                if (s1 || s2) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, rule == openParenSpacing ? "(" : ")", 1);
+                    copied = match[2].rm_eo;
+                    found = applied;
+
+                    // the search skips as many characters as were removed before the paren
+                    cursor = atMost(copied + s1, end);
+                } else {
+                    cursor = match[1].rm_eo + 1;
+                }
+                break;
+            }
+            case operatorFormatting: {
+                if (start >= commentStart) {
+                    scanning = 0;
+                    break;
+                }
+
+                int inQuote = 0;
+                for (size_t i = cursor; i < start; ++i) {
+                    if (source[i] == '"') {
+                        inQuote ^= 1;
+                    }
+                }
+
+                if (inQuote) {
+                    const char * next = strchr(source + match[2].rm_eo, '"');
+
+                    if (!next) {
+                        fprintf(stderr, "rule %d failed to parse quoted section\n", rule);
+                        return error;
+                    }
+
+                    cursor = next - source;
+                    continue;
+                }
+
+                int s2 = matchLength(2);
+
+                if (s2 > 2) {
+                    for (int i = match[2].rm_so; i < match[2].rm_eo; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            found = applied;
+                        }
+                    }
+                }
+
+                int s1 = matchLength(1);
+                int s4 = matchLength(4);
+                int s5 = matchLength(5);
+
+                if (s1 != 1 || (s4 != 1 && s5) || (s4 && !s5)) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, " ", 1);
+                    emit(ctx, &length, source + match[2].rm_so, s2);
+                    emit(ctx, &length, " ", s5);
+                    copied = match[4].rm_eo;
+                    cursor = atMost(copied + !s5, end);
+                    found = applied;
+                } else {
+                    cursor = atMost(match[1].rm_so + s2 + 2, end);
+                }
+                break;
+            }
+            case byteOperatorFormatting: {
+                int s1 = matchLength(1);
+                int s3 = matchLength(3);
+
+                if (s1 != 1 || s3) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, " ", 1);
+                    emit(ctx, &length, source + match[2].rm_so, 2);
+                    copied = cursor = atMost(match[2].rm_eo + 1, end);
+                    found = applied;
+                } else {
+                    cursor = match[1].rm_so + 3;
+                }
+                break;
+            }
+            case commaSpacing: {
+                if (start >= commentStart) {
+                    scanning = 0;
+                    break;
+                }
+
+                int s1 = matchLength(1);
+                int s2 = matchLength(2);
+
+                if (s1 || s2 != 1) {
+                    emit(ctx, &length, source + copied, match[1].rm_so - copied);
+                    emit(ctx, &length, ",", 1);
+
+                    // the space is left in source, where the next search may include it
+                    copied = match[2].rm_eo - 1;
+                    source[copied] = ' ';
+                    cursor = s1 ? atMost(match[2].rm_eo + s1 - 1, end) : copied;
+                    found = applied;
+                } else {
+                    cursor = match[1].rm_eo + 1;
+                }
+                break;
+            }
+            default: {
+                return error;
+            }
+        }
+
+        if (scanning && found > result) {
+            result = found;
+        }
+    }
+
+    if (scanning && status != REG_NOMATCH) {
+        printMatchError(ctx, rule, source, status);
+        return error;
+    }
+
+    if (length || copied) {
+        emit(ctx, &length, source + copied, end - copied);
+
+        if (length >= sizeof(ctx->source)) {
+            fprintf(stderr, "formatted line %d exceeds 4095 characters\n", ctx->lineNum);
+            return error;
+        }
+
+        memcpy(source, ctx->scratch, length);
+        source[length] = '\0';
+    }
+
+    return result;
+}
+
+static result_t applyRule(caddy65_t * ctx, rule_t rule, char * const source, const flags_t flags) {
+    regmatch_t match[16];
+    int status;
+
+    switch (rule) {
+        case tabExpansion:
+        case addressFormatting:
+        case hexLiteralFormatting:
+        case binaryLiteralFormatting:
+        case openParenSpacing:
+        case closeParenSpacing:
+        case operatorFormatting:
+        case byteOperatorFormatting:
+        case commaSpacing: {
+            return applyRepeatedRule(ctx, rule, source, flags);
+        }
+        // the trim rules match every line, so the space is found directly
+        case trimLeading: {
+            size_t s1 = 0;
+            while (isspace((unsigned char) source[s1])) {
+                ++s1;
+            }
+
+            if (s1) {
+                memmove(source, source + s1, strlen(source + s1) + 1);
+                return applied;
+            }
+
+            return compliant;
+        }
+        case trimTrailing: {
+            size_t end = strlen(source);
+            size_t start = end;
+            while (start && isspace((unsigned char) source[start - 1])) {
+                --start;
+            }
+
+            if (start != end) {
+                source[start] = '\0';
+                return applied;
+            }
+
+            return compliant;
+        }
+        // these only classify the line, which the matchers decide alone
+        case onlyComment:
+        case bitwiseInstruction: {
+            status = findMatch(ctx, rule, source, 0, strlen(source), NULL, 0);
+            return status ? notApplied : compliant;
+        }
+        default: {
+            break;
+        }
+    }
+
+    if (rule == macroInstance && ctx->macros) {
+        status = matchMacro(ctx->macros, source, match);
+    } else {
+        status = findMatch(ctx, rule, source, 0, strlen(source), match, 0);
+    }
+
+    if (!status) {
+        switch (rule) {
+            case controlCommand: {
+                result_t result = compliant;
+
+                for (int i = match[1].rm_so; i < match[1].rm_eo; ++i) {
+                    if (isupper(source[i])) {
+                        source[i] = tolower(source[i]);
+                        result = applied;
+                    }
+                }
+
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+
+                if (s2 > 1 && s3) {
+                    if (rewrite(ctx, source, "%.*s %s",
+                        (int) match[2].rm_so, source,
+                        source + match[3].rm_so)) {
+                        return error;
+                    }
+                    result = applied;
+                }
+
+                return result;
+            }
+            case macroDefinition: {
+                int s1 = matchLength(1);
+                int s3 = matchLength(3);
+                int s4 = matchLength(4);
+
+                if (s1 != 1 || (s3 && s4 != 1)) {
+                    int s2 = matchLength(2);
+
+                    if (rewrite(ctx, source, "%.*s %.*s%s%s",
+                        (int) match[1].rm_so, source,
+                        s2, source + match[2].rm_so,
+                        s3 ? " " : "",
+                        source + match[5].rm_so)) {
+                        return error;
+                    }
+                    return applied;
+                }
+
+                return compliant;
+            }
+            case macroInstance: {
+                int s4 = matchLength(4);
+                int s6 = matchLength(6);
+
+                if (s4 && s6 != 1) {
+                    int s1 = matchLength(1);
+
+                    if (rewrite(ctx, source, "%.*s %s",
+                        s1, source,
+                        source + match[7].rm_so)) {
+                        return error;
+                    }
+                    return applied;
+                }
+
+                return compliant;
+            }
+            case namedLabel: {
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+                int s4 = matchLength(4);
+
+                if (s2 || (s3 != 1 && s4)) {
+                    int s1 = matchLength(1);
+
+                    if (rewrite(ctx, source, "%.*s:%s%s",
+                        s1, source,
+                        s4 ? " " : "",
+                        source + match[4].rm_so)) {
+                        return error;
+                    }
+                    return applied;
+                }
+
+                return compliant;
+            }
+            case unnamedLabel: {
+                if (rewrite(ctx, source, "%s", source + match[1].rm_eo)) {
+                    return error;
+                }
+
+                return applied;
+            }
+            case impliedInstruction: {
+                result_t result = compliant;
+
+                for (int i = 0; i < 3; ++i) {
+                    if (isupper(source[i])) {
+                        source[i] = tolower(source[i]);
+                        result = applied;
+                    }
+                }
+
+                return result;
+            }
+            case immediateInstruction:
+            case addressInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+
+                if (s2 != 1) {
+                    if (rewrite(ctx, source, "%c%c%c %s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        source + match[3].rm_so)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+                }
+
+                return result;
+            }
+            case indexedInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+                int s4 = matchLength(4);
+                int s5 = matchLength(5);
+                int idx = match[6].rm_so;
+
+                if (s2 != 1 || s4 || s5 != 1) {
+                    int s3 = matchLength(3);
+
+                    if (rewrite(ctx, source, "%c%c%c %.*s, %c%s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        s3, source + match[3].rm_so,
+                        tolower(source[idx]),
+                        source + match[6].rm_eo)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+
+                    if (isupper(source[idx])) {
+                        source[idx] = tolower(source[idx]);
+                        result = applied;
+                    }
+                }
+
+                return result;
+            }
+            case indirectInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+                int s5 = matchLength(5);
+
+                if (s2 != 1 || s3 || s5) {
+                    int s4 = matchLength(4);
+
+                    if (rewrite(ctx, source, "%c%c%c (%.*s)%s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        s4, source + match[4].rm_so,
+                        source + match[5].rm_eo + 1)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+                }
+
+                return result;
+            }
+            case indirectXInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+                int s5 = matchLength(5);
+                int s6 = matchLength(6);
+                int s8 = matchLength(8);
+
+                if (s2 != 1 || s3 || s5 || s6 != 1 || s8) {
+                    int s4 = matchLength(4);
+
+                    if (rewrite(ctx, source, "%c%c%c (%.*s, x)%s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        s4, source + match[4].rm_so,
+                        source + match[8].rm_eo + 1)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+
+                    int idx = match[7].rm_so;
+                    if (source[idx] == 'X') {
+                        source[idx] = 'x';
+                        result = applied;
+                    }
+                }
+
+                return result;
+            }
+            case indirectYInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+                int s5 = matchLength(5);
+                int s6 = matchLength(6);
+                int s7 = matchLength(7);
+
+                if (s2 != 1 || s3 || s5 || s6 || s7 != 1) {
+                    int s4 = matchLength(4);
+
+                    if (rewrite(ctx, source, "%c%c%c (%.*s), y%s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        s4, source + match[4].rm_so,
+                        source + match[8].rm_eo)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+
+                    int idx = match[8].rm_so;
+                    if (source[idx] == 'Y') {
+                        source[idx] = 'y';
+                        result = applied;
+                    }
+                }
+
+                return result;
+            }
+            case relativeInstruction: {
+                result_t result = compliant;
+                int s2 = matchLength(2);
+
+                if (s2 != 1) {
+                    if (rewrite(ctx, source, "%c%c%c :%s",
+                        tolower(source[0]), tolower(source[1]), tolower(source[2]),
+                        source + match[3].rm_so)) {
+                        return error;
+                    }
+                    result = applied;
+                } else {
+                    for (int i = 0; i < 3; ++i) {
+                        if (isupper(source[i])) {
+                            source[i] = tolower(source[i]);
+                            result = applied;
+                        }
+                    }
+                }
+
+                return result;
+            }
+            case commentSpacing: {
+                int s1 = matchLength(1);
+                int s2 = matchLength(2);
+                int s3 = matchLength(3);
+
+                if (s1 != 1 || (s2 != 1 && s3)) {
+                    int mlp = match[1].rm_eo == 0 ? 0 : 1;
+                    int mtp = !s3 ? 0 : 1;
+
+                    if (rewrite(ctx, source, "%.*s%*.*s;%*.*s%s",
+                        (int) match[0].rm_so, source,
+                        mlp, s1 > mlp ? s1 : mlp, s1 ? source + match[1].rm_so : " ",
+                        mtp, s2 > mtp ? s2 : mtp, s2 ? source + match[2].rm_so : " ",
+                        source + match[3].rm_so)) {
+                        return error;
+                    }
+
+                    return applied;
+                }
+
+                return compliant;
+            }
+            default: {
+                return error;
+            }
+        }
+    } else if (status == REG_NOMATCH) {
+        return notApplied;
+    } else {
+        printMatchError(ctx, rule, source, status);
+        return error;
+    }
+
+    return error;
+}
+
+static uint64_t hashLine(const char * line, size_t len, int prevLineBlank) {
+    uint64_t hash = 14695981039346656037ull ^ prevLineBlank;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t) line[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// applies a single rule and updates the flags for the rest of the line
+static inline result_t applyStep(caddy65_t * ctx, rule_t rule, char * source, flags_t * flags) {
+    trace2(rule__start, ctx->lineNum, rule);
+    result_t result = applyRule(ctx, rule, source, *flags);
+    trace3(rule__end, ctx->lineNum, rule, result);
+
+    if (result == error) {
+        return error;
+    }
+
+    switch (rule) {
+        case onlyComment: {
+            if (result == compliant || result == applied) {
+                if (*source == ';') {
+                    *flags &= ~prependIndention;
+                } else {
+                    *flags |= prependIndention;
+                }
+            }
+            break;
+        }
+        case trimTrailing: {
+            if (!*source) {
+                if (ctx->prevLineBlank) {
+                    *flags |= omit;
+                } else {
+                    ctx->prevLineBlank = 1;
+                    *flags &= ~prependIndention;
+                    *flags |= done;
+                }
+            } else {
+                ctx->prevLineBlank = 0;
+            }
+            break;
+        }
+        case bitwiseInstruction: {
+            if (result == compliant || result == applied) {
+                *flags |= bitwiseOperation;
+            }
+            break;
+        }
+        case controlCommand: {
+            if ((result == compliant || result == applied) && *source != ';') {
+                if (strncmp(source + 1, "asciiz",  6) == 0 ||
+                    strncmp(source + 1, "addr",    4) == 0 ||
+                    strncmp(source + 1, "byt",     3) == 0 ||
+                    strncmp(source + 1, "byte",    4) == 0 ||
+                    strncmp(source + 1, "dbyt",    4) == 0 ||
+                    strncmp(source + 1, "dword",   5) == 0 ||
+                    strncmp(source + 1, "lobytes", 7) == 0 ||
+                    strncmp(source + 1, "hibytes", 7) == 0 ||
+                    strncmp(source + 1, "word",    4) == 0) {
+
+                    *flags |= prependIndention;
+                } else {
+                    *flags &= ~prependIndention;
+                }
+            }
+            break;
+        }
+        case namedLabel: {
+            if (result == compliant || result == applied) {
+                *flags &= ~prependIndention;
+            }
+            break;
+        }
+        case unnamedLabel: {
+            if (result == compliant || result == applied) {
+                *flags |= prependLabel;
+            }
+            break;
+        }
+        case macroInstance:
+        case impliedInstruction:
+        case immediateInstruction:
+        case addressInstruction:
+        case indexedInstruction:
+        case indirectInstruction:
+        case indirectXInstruction:
+        case indirectYInstruction:
+        case relativeInstruction: {
+            if (result == compliant || result == applied) {
+                *flags |= prependIndention;
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    printRuleResult(rule, result, *flags);
+    return result;
+}
+
+// strips the newline from a line about to go through the rules
+static flags_t startLine(char * source) {
+    flags_t flags = prependIndention;
+
+    char * c = strchr(source, '\n');
+    if (c) {
+        flags |= appendNewline;
+        *c = '\0';
+    }
+
+    return flags;
+}
+
+static result_t applyRules(caddy65_t * ctx, flags_t * result) {
+    char * const source = ctx->source;
+    flags_t flags = startLine(source);
+
+#ifdef forEachEnabledRule
+    // specialised builds apply a fixed sequence of rules, which may be empty
+#define applyEnabledRule(rule) \
+    if (applyStep(ctx, rule, source, &flags) == error) { \
+        return error; \
+    } \
+    if (flags & (done | omit)) { \
+        break; \
+    }
+
+    do {
+        forEachEnabledRule(applyEnabledRule)
+    } while (0);
+#undef applyEnabledRule
+#else
+    for (int i = 0; i < numRules; ++i) {
+        if (!isEnabled(ctx, i)) {
+            continue;
+        }
+
+        if (applyStep(ctx, i, source, &flags) == error) {
+            return error;
+        }
+
+        if (flags & (done | omit)) {
+            break;
+        }
+    }
+#endif
+
+    *result = flags;
+    return compliant;
+}
+
+// tracks preformatted blocks, returning 1 if the line is left as written
+static int isPreformatted(caddy65_t * ctx, const char * source) {
+    int skip = ctx->insidePreformattedBlock;
+
+    if (!skip && strstr(source, preformatted)) {
+        skip = 1;
+    }
+
+    if (strstr(source, preformattedStart)) {
+        ++ctx->insidePreformattedBlock;
+        skip = 1;
+    }
+
+    if (strstr(source, preformattedEnd)) {
+        if (!ctx->insidePreformattedBlock) {
+            printf("%s command on line %d is not inside a preformatted block: ignoring\n",
+                preformattedEnd, ctx->lineNum);
+        } else {
+            --ctx->insidePreformattedBlock;
+        }
+
+        skip = 1;
+    }
+
+    if (skip) {
+        ++ctx->stats.preformattedLines;
+        ctx->prevLineBlank = 0;
+    }
+
+    return skip;
+}
+
+static int entryMatches(const cacheEntry_t * entry, uint64_t hash, uint64_t digest, int prevLineBlank,
+    const char * line, size_t len) {
+
+    return entry->hash == hash && entry->lineSize == len && entry->macros == digest &&
+        entry->prevLineBlank == prevLineBlank && memcmp(entry->line, line, len) == 0;
+}
+
+static void fillEntry(cacheEntry_t * entry, uint64_t hash, uint64_t digest, int prevLineBlank,
+    const char * line, size_t len) {
+
+    entry->valid = 0;
+    entry->hash = hash;
+    entry->macros = digest;
+    entry->prevLineBlank = prevLineBlank;
+    entry->lineSize = len;
+    memcpy(entry->line, line, len);
+}
+
+static void storeEntry(cacheEntry_t * entry, const char * output, size_t outputLength, int nextLineBlank) {
+    if (outputLength < cacheOutputSize) {
+        memcpy(entry->output, output, outputLength);
+        entry->outputSize = outputLength;
+        entry->nextLineBlank = nextLineBlank;
+        entry->valid = 1;
+    }
+}
+
+static caddy65_status_t formatLine(caddy65_t * ctx, char * output, size_t outputSize, size_t * outputLength) {
+    char * const source = ctx->source;
+
+    ++ctx->lineNum;
+    ++ctx->stats.lines;
+
+    if (isPreformatted(ctx, source)) {
+        return printLineResult(ctx, source, output, outputSize, outputLength, 0, 1);
+    }
+
+    size_t len = strlen(source);
+    uint64_t digest = ctx->macros ? ctx->macros->digest : 0;
+    uint64_t hash = hashLine(source, len, ctx->prevLineBlank) ^ digest;
+    cacheEntry_t * entry = ctx->cache + (hash & (cacheSize - 1));
+    int cacheable = len <= cacheLineSize;
+
+    if (cacheable) {
+        if (entry->valid && entryMatches(entry, hash, digest, ctx->prevLineBlank, source, len)) {
+            ++ctx->stats.cacheHits;
+
+            if (entry->outputSize >= outputSize) {
+                return caddy65Overflow;
+            }
+
+            memcpy(output, entry->output, entry->outputSize);
+            output[entry->outputSize] = '\0';
+            *outputLength = entry->outputSize;
+            ctx->prevLineBlank = entry->nextLineBlank;
+            return caddy65Success;
+        }
+
+        ++ctx->stats.cacheMisses;
+        fillEntry(entry, hash, digest, ctx->prevLineBlank, source, len);
+    }
+
+    flags_t flags;
+    if (applyRules(ctx, &flags) == error) {
+        return caddy65Error;
+    }
+
+    caddy65_status_t status = printLineResult(ctx, source, output, outputSize, outputLength, flags, 0);
+
+    if (cacheable && status == caddy65Success) {
+        storeEntry(entry, output, *outputLength, ctx->prevLineBlank);
+    }
+
+    return status;
+}
+
+// formats a block of lines one rule at a time, with the same results as formatLine
+static caddy65_status_t formatBlock(caddy65_t * ctx, block_t * block, int numLines,
+    char * output, size_t outputSize, size_t * total) {
+
+    const int firstLine = ctx->lineNum;
+    const uint64_t digest = ctx->macros ? ctx->macros->digest : 0;
+
+    for (int i = 0; i < cacheSize; ++i) {
+        block->slotOwner[i] = -1;
+    }
+
+    // preformatted blocks, the cache and blank lines depend on the lines before
+    for (int i = 0; i < numLines; ++i) {
+        char * const source = block->source[i];
+        size_t len = strlen(source);
+
+        ++ctx->lineNum;
+        ++ctx->stats.lines;
+        block->owner[i] = -1;
+
+        if (isPreformatted(ctx, source)) {
+            block->state[i] = linePreformatted;
+            continue;
+        }
+
+        if (len <= cacheLineSize) {
+            uint64_t hash = hashLine(source, len, ctx->prevLineBlank) ^ digest;
+            size_t slot = hash & (cacheSize - 1);
+            cacheEntry_t * entry = ctx->cache + slot;
+            int owner = block->slotOwner[slot];
+
+            if (entry->valid && entryMatches(entry, hash, digest, ctx->prevLineBlank, source, len)) {
+                ++ctx->stats.cacheHits;
+
+                // a later miss may reuse the entry before the output is written
+                memcpy(source, entry->output, entry->outputSize);
+                source[entry->outputSize] = '\0';
+                ctx->prevLineBlank = entry->nextLineBlank;
+                block->state[i] = lineCached;
+                continue;
+            }
+
+            // line by line, the earlier line would already be in the cache
+            if (owner >= 0 && entryMatches(entry, hash, digest, ctx->prevLineBlank, source, len)) {
+                ctx->prevLineBlank = block->nextLineBlank[owner];
+                block->owner[i] = owner;
+                block->state[i] = lineRepeated;
+                continue;
+            }
+
+            ++ctx->stats.cacheMisses;
+            fillEntry(entry, hash, digest, ctx->prevLineBlank, source, len);
+            block->slotOwner[slot] = i;
+            block->owner[i] = i;
+            block->hash[i] = hash;
+            block->prevLineBlank[i] = ctx->prevLineBlank;
+        }
+
+        flags_t flags = startLine(source);
+
+        for (int rule = 0; rule <= trimTrailing && !(flags & (done | omit)); ++rule) {
+            if (isEnabled(ctx, rule) && applyStep(ctx, rule, source, &flags) == error) {
+                return caddy65Error;
+            }
+        }
+
+        block->flags[i] = flags;
+        block->state[i] = flags & (done | omit) ? lineFinished : lineActive;
+        block->nextLineBlank[i] = ctx->prevLineBlank;
+    }
+
+    // the remaining rules only depend on the line itself
+    for (int rule = trimTrailing + 1; rule < numRules; ++rule) {
+        if (!isEnabled(ctx, rule)) {
+            continue;
+        }
+
+        for (int i = 0; i < numLines; ++i) {
+            if (block->state[i] != lineActive) {
+                continue;
+            }
+
+            flags_t flags = block->flags[i];
+            ctx->lineNum = firstLine + i + 1;
+
+            if (applyStep(ctx, rule, block->source[i], &flags) == error) {
+                return caddy65Error;
+            }
+
+            block->flags[i] = flags;
+
+            if (flags & (done | omit)) {
+                block->state[i] = lineFinished;
+            }
+        }
+    }
+
+    ctx->lineNum = firstLine + numLines;
+
+    for (int i = 0; i < numLines; ++i) {
+        const char * const source = block->source[i];
+        char * const out = output + *total;
+        size_t room = outputSize - *total;
+        size_t written = 0;
+        caddy65_status_t status = caddy65Success;
+
+        switch (block->state[i]) {
+            case linePreformatted: {
+                status = printLineResult(ctx, source, out, room, &written, 0, 1);
+                break;
+            }
+            case lineCached: {
+                written = strlen(source);
+
+                if (written >= room) {
+                    status = caddy65Overflow;
+                } else {
+                    memcpy(out, source, written + 1);
+                }
+                break;
+            }
+            case lineRepeated: {
+                int owner = block->owner[i];
+                written = block->outputLength[owner];
+
+                if (written < cacheOutputSize) {
+                    ++ctx->stats.cacheHits;
+                } else {
+                    ++ctx->stats.cacheMisses;
+                }
+
+                if (written >= room) {
+                    status = caddy65Overflow;
+                } else {
+                    memcpy(out, output + block->outputStart[owner], written);
+                    out[written] = '\0';
+                }
+                break;
+            }
+            default: {
+                status = printLineResult(ctx, source, out, room, &written, block->flags[i], 0);
+
+                // stored in line order, so each entry ends up as formatLine would leave it
+                if (status == caddy65Success && block->owner[i] == i) {
+                    cacheEntry_t * entry = ctx->cache + (block->hash[i] & (cacheSize - 1));
+
+                    fillEntry(entry, block->hash[i], digest, block->prevLineBlank[i],
+                        block->input[i], strnlen(block->input[i], block->inputSize[i]));
+                    storeEntry(entry, out, written, block->nextLineBlank[i]);
+                }
+                break;
+            }
+        }
+
+        if (status != caddy65Success) {
+            return status;
+        }
+
+        if (written != block->inputSize[i] || memcmp(out, block->input[i], written)) {
+            ++ctx->stats.changedLines;
+        }
+
+        block->outputStart[i] = *total;
+        block->outputLength[i] = written;
+        *total += written;
+    }
+
+    return caddy65Success;
+}
+
+static int findRule(const char * name) {
+    size_t slot = hashName(name, strlen(name)) & (ruleSlotCount - 1);
+
+    while (ruleSlots[slot] >= 0 && strcmp(ruleNames[ruleSlots[slot]], name)) {
+        slot = (slot + 1) & (ruleSlotCount - 1);
+    }
+
+    return ruleSlots[slot];
+}
+
+caddy65_t * caddy65Create(const char * config) {
+    caddy65_t * ctx = calloc(1, sizeof(caddy65_t));
+    if (!ctx) {
+        fprintf(stderr, "failed to allocate context\n");
+        return NULL;
+    }
+
+    ctx->enabled = ~0u;
+    ctx->indentionSize = strlen(indention);
+
+    while (config && *config) {
+        const char * end = strchr(config, '\n');
+        size_t len = end ? (size_t) (end - config) : strlen(config);
+
+        if (len > 4095) {
+            len = 4095;
+        }
+
+        memcpy(ctx->source, config, len);
+        ctx->source[len] = '\0';
+        config += end ? len + 1 : len;
+
+        char * c = strchr(ctx->source, ':');
+
+        if (!c) {
+            fprintf(stderr, "failed to read config: \"%s\"\n", ctx->source);
+            free(ctx);
+            return NULL;
+        }
+
+        int enable = strstr(c, "enabled") ? 1 : 0;
+
+        *c = '\0';
+        int rule = findRule(ctx->source);
+
+        if (rule < 0) {
+            printf("unknown rule read from config file: \"%s\"\n", ctx->source);
+        } else if (enable) {
+            ctx->enabled |= (1u << rule);
+        } else {
+            ctx->enabled &= ~(1u << rule);
+        }
+    }
+
+#ifdef enabledRules
+    // rules are fixed in specialised builds
+    for (int i = 0; config && i < numRules; ++i) {
+        if ((ctx->enabled ^ enabledRules) & (1u << i)) {
+            fprintf(stderr, "rule \"%s\" is %s in this build\n", ruleNames[i],
+                enabledRules & (1u << i) ? "enabled" : "disabled");
+        }
+    }
+
+    ctx->enabled = enabledRules;
+#endif
+
+    return ctx;
+}
+
+caddy65_t * caddy65Copy(const caddy65_t * ctx) {
+    caddy65_t * copy = calloc(1, sizeof(caddy65_t));
+    if (!copy) {
+        fprintf(stderr, "failed to allocate context\n");
+        return NULL;
+    }
+
+    copy->enabled = ctx->enabled;
+    copy->indentionSize = ctx->indentionSize;
+    return copy;
+}
+
+void caddy65Free(caddy65_t * ctx) {
+    if (!ctx) {
+        return;
+    }
+
+    for (int i = 0; i < numRules; ++i) {
+        if (ctx->compiled & (1u << i)) {
+            regfree(ctx->regex + i);
+        }
+    }
+
+    free(ctx->block);
+    free(ctx);
+}
+
+void caddy65Stats(const caddy65_t * ctx, caddy65_stats_t * stats) {
+    *stats = ctx->stats;
+}
+
+caddy65_macros_t * caddy65MacrosCreate(void) {
+    caddy65_macros_t * macros = calloc(1, sizeof(caddy65_macros_t));
+    if (!macros) {
+        fprintf(stderr, "failed to allocate macro index\n");
+    } else {
+        macros->digest = 1;
+    }
+
+    return macros;
+}
+
+caddy65_status_t caddy65MacrosScan(caddy65_macros_t * macros, const char * input, size_t inputSize,
+    caddy65_include_t include, void * user) {
+
+    const char * end = input + inputSize;
+
+    while (input < end) {
+        const char * eol = memchr(input, '\n', end - input);
+        if (!eol) {
+            eol = end;
+        }
+
+        const char * c = skipSpace(input, eol);
+        const char * arg;
+
+        if ((arg = matchCommand(c, eol, "macro")) || (arg = matchCommand(c, eol, "mac"))) {
+            size_t len = symbolLength(arg, eol - arg);
+
+            if (len && addMacro(macros, arg, len)) {
+                fprintf(stderr, "failed to allocate macro index\n");
+                return caddy65Error;
+            }
+        } else if (include && (arg = matchCommand(c, eol, "include")) && *arg == '"') {
+            const char * close = memchr(arg + 1, '"', eol - arg - 1);
+
+            if (close && close - arg - 1 < 4096) {
+                char path[4096];
+                memcpy(path, arg + 1, close - arg - 1);
+                path[close - arg - 1] = '\0';
+
+                if (include(macros, path, user) != caddy65Success) {
+                    return caddy65Error;
+                }
+            }
+        }
+
+        input = eol + 1;
+    }
+
+    return caddy65Success;
+}
+
+caddy65_status_t caddy65MacrosMerge(caddy65_macros_t * macros, const caddy65_macros_t * other) {
+    for (size_t i = 0; i < other->capacity; ++i) {
+        if (other->names[i] && addMacro(macros, other->names[i], strlen(other->names[i]))) {
+            fprintf(stderr, "failed to allocate macro index\n");
+            return caddy65Error;
+        }
+    }
+
+    return caddy65Success;
+}
+
+void caddy65MacrosFree(caddy65_macros_t * macros) {
+    if (!macros) {
+        return;
+    }
+
+    for (size_t i = 0; i < macros->capacity; ++i) {
+        free(macros->names[i]);
+    }
+
+    free(macros->names);
+    free(macros);
+}
+
+void caddy65UseMacros(caddy65_t * ctx, const caddy65_macros_t * macros) {
+    ctx->macros = macros;
+}
+
+caddy65_status_t caddy65UseBlocks(caddy65_t * ctx, int enable) {
+    if (!enable) {
+        free(ctx->block);
+        ctx->block = NULL;
+    } else if (!ctx->block) {
+        ctx->block = malloc(sizeof(block_t));
+
+        if (!ctx->block) {
+            fprintf(stderr, "failed to allocate line blocks\n");
+            return caddy65Error;
+        }
+    }
+
+    return caddy65Success;
+}
+
+void caddy65Reset(caddy65_t * ctx) {
+    ctx->insidePreformattedBlock = 0;
+    ctx->lineNum = 0;
+    ctx->prevLineBlank = 0;
+}
+
+caddy65_status_t caddy65FormatLine(caddy65_t * ctx, const char * line, size_t lineSize,
+    char * output, size_t outputSize, size_t * outputLength) {
+
+    if (lineSize > 4095) {
+        fprintf(stderr, "source line %d exceeds 4095 characters\n", ctx->lineNum + 1);
+        return caddy65Error;
+    }
+
+    memcpy(ctx->source, line, lineSize);
+    ctx->source[lineSize] = '\0';
+
+    trace2(line__start, ctx->lineNum + 1, lineSize);
+    caddy65_status_t status = formatLine(ctx, output, outputSize, outputLength);
+    trace2(line__end, ctx->lineNum, status);
+
+    if (status == caddy65Success && (*outputLength != lineSize || memcmp(output, line, lineSize))) {
+        ++ctx->stats.changedLines;
+    }
+
+    return status;
+}
+
+static caddy65_status_t formatBuffer(caddy65_t * ctx, const char * input, size_t inputSize,
+    char * output, size_t outputSize, size_t * outputLength) {
+
+    block_t * const block = ctx->block;
+    int numLines = 0;
+    size_t total = 0;
+
+    if (!outputSize) {
+        return caddy65Overflow;
+    }
+
+    *output = '\0';
+
+    while (inputSize) {
+        const char * end = memchr(input, '\n', inputSize);
+        size_t len = end ? (size_t) (end - input) + 1 : inputSize;
+        caddy65_status_t status = caddy65Success;
+
+        // mirror fgets, which splits lines longer than its buffer
+        if (len > 4095) {
+            len = 4095;
+        }
+
+        if (block) {
+            block->input[numLines] = input;
+            block->inputSize[numLines] = len;
+            memcpy(block->source[numLines], input, len);
+            block->source[numLines][len] = '\0';
+            ++numLines;
+        } else {
+            size_t written = 0;
+            status = caddy65FormatLine(ctx, input, len, output + total, outputSize - total, &written);
+            total += written;
+        }
+
+        input += len;
+        inputSize -= len;
+
+        if (numLines && (numLines == blockLines || !inputSize)) {
+            trace2(block__start, ctx->lineNum + 1, numLines);
+            status = formatBlock(ctx, block, numLines, output, outputSize, &total);
+            trace2(block__end, numLines, status);
+            numLines = 0;
+        }
+
+        if (status != caddy65Success) {
+            return status;
+        }
+    }
+
+    *outputLength = total;
+    return caddy65Success;
+}
+
+caddy65_status_t caddy65FormatBuffer(caddy65_t * ctx, const char * input, size_t inputSize,
+    char * output, size_t outputSize, size_t * outputLength) {
+
+    caddy65Reset(ctx);
+
+    trace2(file__start, input, inputSize);
+    caddy65_status_t status = formatBuffer(ctx, input, inputSize, output, outputSize, outputLength);
+    trace2(file__end, ctx->lineNum, status);
+
+    return status;
+}
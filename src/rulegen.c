@@ -0,0 +1,754 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rules.h"
+
+/*
+ * Compiles each rule pattern into a DFA and prints it as C tables.
+ *
+ * The input is treated as a beginning of line symbol, the line's characters,
+ * and an end of line symbol, which lets '^' and '$' be matched as ordinary
+ * symbols. Each rule gets two DFAs. The reverse DFA is run from the end of the
+ * line towards its start, and accepts at each position where a match starts.
+ * The forward DFA is run from a known start and accepts wherever a match from
+ * there ends. Together they give the extent of the leftmost-longest match, so
+ * libcaddy65 only runs regexec on that window, to find the subexpressions.
+ *
+ * It also prints a hash table of rule names for reading configs. Given a
+ * caddy65.cfg, it fixes the enabled rules at build time, so libcaddy65 can
+ * apply them in sequence without checking the config for every line.
+ */
+
+#define bol 256
+#define eol 257
+#define numSymbols 258
+
+#define maxNodes 4096
+#define maxStates 65536
+#define maxDfaStates 4096
+#define ruleSlotCount 64
+
+typedef struct {
+    uint64_t bits[5];
+} set_t;
+
+typedef enum {
+    symbolNode,
+    concatNode,
+    alternateNode,
+    repeatNode,
+} nodeType_t;
+
+typedef struct {
+    nodeType_t type;
+    set_t set;
+    int children[64];
+    int numChildren;
+    int min;
+    int max;
+} node_t;
+
+typedef enum {
+    splitState,
+    symbolState,
+    acceptState,
+} stateType_t;
+
+typedef struct {
+    stateType_t type;
+    int set;
+    int out[2];
+} state_t;
+
+typedef enum {
+    forwardMatcher,
+    reverseMatcher,
+} direction_t;
+
+static const char * const directionNames[] = { "Forward", "Reverse" };
+
+static direction_t direction;
+
+static node_t nodes[maxNodes];
+static int numNodes;
+
+static state_t states[maxStates];
+static int numStates;
+
+static set_t sets[maxStates];
+static int numSets;
+
+static const char * pattern;
+static const char * cursor;
+
+static void fail(const char * message) {
+    fprintf(stderr, "rulegen: %s at offset %d of pattern: %s\n", message, (int) (cursor - pattern), pattern);
+    exit(1);
+}
+
+static void addSymbol(set_t * set, int sym) {
+    set->bits[sym / 64] |= 1ull << (sym % 64);
+}
+
+static int hasSymbol(const set_t * set, int sym) {
+    return (set->bits[sym / 64] >> (sym % 64)) & 1;
+}
+
+static void addChar(set_t * set, int c) {
+    addSymbol(set, c);
+
+    // patterns are compiled with REG_ICASE
+    if (isalpha(c)) {
+        addSymbol(set, tolower(c));
+        addSymbol(set, toupper(c));
+    }
+}
+
+static int newNode(nodeType_t type) {
+    if (numNodes == maxNodes) {
+        fail("too many nodes");
+    }
+
+    node_t * node = nodes + numNodes;
+    memset(node, 0, sizeof(node_t));
+    node->type = type;
+    return numNodes++;
+}
+
+static void addChild(int parent, int child) {
+    if (nodes[parent].numChildren == 64) {
+        fail("too many children");
+    }
+
+    nodes[parent].children[nodes[parent].numChildren++] = child;
+}
+
+static int parseClass(set_t * set) {
+    static const struct {
+        const char * name;
+        int (* test)(int);
+    } classes[] = {
+        { "alnum", isalnum },
+        { "alpha", isalpha },
+        { "digit", isdigit },
+        { "lower", islower },
+        { "print", isprint },
+        { "punct", ispunct },
+        { "space", isspace },
+        { "upper", isupper },
+        { "xdigit", isxdigit },
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i) {
+        size_t len = strlen(classes[i].name);
+
+        if (strncmp(cursor, classes[i].name, len) == 0 && strncmp(cursor + len, ":]", 2) == 0) {
+            for (int c = 1; c < 256; ++c) {
+                if (classes[i].test(c)) {
+                    addChar(set, c);
+                }
+            }
+
+            cursor += len + 2;
+            return 1;
+        }
+    }
+
+    fail("unknown character class");
+    return 0;
+}
+
+static int parseBracket(void) {
+    int node = newNode(symbolNode);
+    set_t set = { { 0 } };
+    int negate = 0;
+
+    if (*cursor == '^') {
+        negate = 1;
+        ++cursor;
+    }
+
+    // a leading ']' is a literal, and backslashes are always literals
+    int first = 1;
+
+    while (*cursor && (first || *cursor != ']')) {
+        first = 0;
+
+        if (strncmp(cursor, "[:", 2) == 0) {
+            cursor += 2;
+            parseClass(&set);
+        } else if (cursor[1] == '-' && cursor[2] && cursor[2] != ']') {
+            for (int c = (unsigned char) cursor[0]; c <= (unsigned char) cursor[2]; ++c) {
+                addChar(&set, c);
+            }
+
+            cursor += 3;
+        } else {
+            addChar(&set, (unsigned char) *cursor++);
+        }
+    }
+
+    if (*cursor++ != ']') {
+        fail("unterminated bracket expression");
+    }
+
+    if (negate) {
+        for (int c = 1; c < 256; ++c) {
+            if (!hasSymbol(&set, c)) {
+                addSymbol(&nodes[node].set, c);
+            }
+        }
+    } else {
+        nodes[node].set = set;
+    }
+
+    return node;
+}
+
+static int parseAlternation(void);
+
+static int parseAtom(void) {
+    char c = *cursor++;
+
+    switch (c) {
+        case '(': {
+            int node = parseAlternation();
+            if (*cursor++ != ')') {
+                fail("unbalanced parenthesis");
+            }
+            return node;
+        }
+        case '[': {
+            return parseBracket();
+        }
+        case '.': {
+            int node = newNode(symbolNode);
+            for (int i = 1; i < 256; ++i) {
+                addSymbol(&nodes[node].set, i);
+            }
+            return node;
+        }
+        case '^': {
+            int node = newNode(symbolNode);
+            addSymbol(&nodes[node].set, bol);
+            return node;
+        }
+        case '$': {
+            int node = newNode(symbolNode);
+            addSymbol(&nodes[node].set, eol);
+            return node;
+        }
+        case '\\': {
+            c = *cursor++;
+            if (!c) {
+                fail("trailing backslash");
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    int node = newNode(symbolNode);
+    addChar(&nodes[node].set, (unsigned char) c);
+    return node;
+}
+
+static int parseRepetition(void) {
+    int node = parseAtom();
+
+    while (*cursor && strchr("*+?{", *cursor)) {
+        int repeat = newNode(repeatNode);
+        addChild(repeat, node);
+
+        switch (*cursor++) {
+            case '*': {
+                nodes[repeat].min = 0;
+                nodes[repeat].max = -1;
+                break;
+            }
+            case '+': {
+                nodes[repeat].min = 1;
+                nodes[repeat].max = -1;
+                break;
+            }
+            case '?': {
+                nodes[repeat].min = 0;
+                nodes[repeat].max = 1;
+                break;
+            }
+            default: {
+                char * end;
+                nodes[repeat].min = strtol(cursor, &end, 10);
+                nodes[repeat].max = nodes[repeat].min;
+
+                if (*end == ',') {
+                    nodes[repeat].max = end[1] == '}' ? -1 : strtol(end + 1, &end, 10);
+                    if (nodes[repeat].max == -1) {
+                        ++end;
+                    }
+                }
+
+                if (*end != '}') {
+                    fail("malformed interval");
+                }
+
+                cursor = end + 1;
+                break;
+            }
+        }
+
+        node = repeat;
+    }
+
+    return node;
+}
+
+static int parseConcatenation(void) {
+    int node = newNode(concatNode);
+
+    while (*cursor && *cursor != '|' && *cursor != ')') {
+        addChild(node, parseRepetition());
+    }
+
+    return node;
+}
+
+static int parseAlternation(void) {
+    int node = newNode(alternateNode);
+    addChild(node, parseConcatenation());
+
+    while (*cursor == '|') {
+        ++cursor;
+        addChild(node, parseConcatenation());
+    }
+
+    return node;
+}
+
+static int newState(stateType_t type, int out0, int out1) {
+    if (numStates == maxStates) {
+        fail("too many states");
+    }
+
+    states[numStates].type = type;
+    states[numStates].set = -1;
+    states[numStates].out[0] = out0;
+    states[numStates].out[1] = out1;
+    return numStates++;
+}
+
+// builds the states for a node, continuing with next once it has matched
+static int compile(int node, int next) {
+    node_t * n = nodes + node;
+
+    switch (n->type) {
+        case symbolNode: {
+            int state = newState(symbolState, next, -1);
+            sets[numSets] = n->set;
+            states[state].set = numSets++;
+            return state;
+        }
+        case concatNode: {
+            if (direction == reverseMatcher) {
+                for (int i = 0; i < n->numChildren; ++i) {
+                    next = compile(n->children[i], next);
+                }
+            } else {
+                for (int i = n->numChildren - 1; i >= 0; --i) {
+                    next = compile(n->children[i], next);
+                }
+            }
+            return next;
+        }
+        case alternateNode: {
+            int start = compile(n->children[0], next);
+            for (int i = 1; i < n->numChildren; ++i) {
+                start = newState(splitState, start, compile(n->children[i], next));
+            }
+            return start;
+        }
+        case repeatNode: {
+            int child = n->children[0];
+
+            if (n->max < 0) {
+                int loop = newState(splitState, -1, next);
+                states[loop].out[0] = compile(child, loop);
+                next = loop;
+            } else {
+                for (int i = n->min; i < n->max; ++i) {
+                    next = newState(splitState, compile(child, next), next);
+                }
+            }
+
+            for (int i = 0; i < n->min; ++i) {
+                next = compile(child, next);
+            }
+
+            return next;
+        }
+    }
+
+    return next;
+}
+
+typedef struct {
+    int * members;
+    int size;
+    int accept;
+} dfaState_t;
+
+static dfaState_t dfa[maxDfaStates];
+static int numDfaStates;
+static unsigned short next[maxDfaStates][numSymbols];
+
+static int stack[maxStates * 3];
+static unsigned char visited[maxStates];
+
+
+static int ruleClasses[2][numRules];
+static uint32_t anchoredRules;
+
+static int compareInts(const void * a, const void * b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+static int closure(int * members, int size) {
+    int top = 0;
+    int count = 0;
+
+    memset(visited, 0, numStates);
+
+    for (int i = 0; i < size; ++i) {
+        stack[top++] = members[i];
+    }
+
+    while (top) {
+        int state = stack[--top];
+        if (state < 0 || visited[state]) {
+            continue;
+        }
+
+        visited[state] = 1;
+
+        if (states[state].type == splitState) {
+            stack[top++] = states[state].out[0];
+            stack[top++] = states[state].out[1];
+        } else {
+            members[count++] = state;
+        }
+    }
+
+    qsort(members, count, sizeof(int), compareInts);
+    return count;
+}
+
+static int findDfaState(int * members, int size) {
+    for (int i = 0; i < numDfaStates; ++i) {
+        if (dfa[i].size == size && memcmp(dfa[i].members, members, size * sizeof(int)) == 0) {
+            return i;
+        }
+    }
+
+    if (numDfaStates == maxDfaStates) {
+        fail("too many DFA states");
+    }
+
+    dfaState_t * d = dfa + numDfaStates;
+    d->members = malloc(size * sizeof(int) + 1);
+    memcpy(d->members, members, size * sizeof(int));
+    d->size = size;
+    d->accept = 0;
+
+    for (int i = 0; i < size; ++i) {
+        if (states[members[i]].type == acceptState) {
+            d->accept = 1;
+        }
+    }
+
+    return numDfaStates++;
+}
+
+// returns 1 if every match must begin with '^'
+static int isAnchored(int start, int * members) {
+    set_t onlyBol = { { 0 } };
+    addSymbol(&onlyBol, bol);
+
+    members[0] = start;
+    int size = closure(members, 1);
+
+    for (int i = 0; i < size; ++i) {
+        state_t * s = states + members[i];
+
+        if (s->type != symbolState || memcmp(sets + s->set, &onlyBol, sizeof(set_t))) {
+            return 0;
+        }
+    }
+
+    return size > 0;
+}
+
+static void generate(int rule, direction_t dir) {
+    static int members[maxStates];
+
+    numNodes = 0;
+    numStates = 0;
+    numSets = 0;
+    direction = dir;
+    pattern = cursor = patterns[rule];
+
+    int root = parseAlternation();
+    if (*cursor) {
+        fail("unexpected character");
+    }
+
+    int match = compile(root, newState(acceptState, -1, -1));
+    int start = newState(splitState, match, -1);
+    int other = newState(symbolState, -1, -1);
+    sets[numSets] = (set_t) { { 0 } };
+    states[other].set = numSets++;
+    states[start].out[1] = other;
+
+    if (dir == forwardMatcher) {
+        // a match from the first character may also begin with the beginning of line
+        addSymbol(sets + states[other].set, bol);
+        states[other].out[0] = match;
+
+        if (isAnchored(match, members)) {
+            anchoredRules |= 1u << rule;
+        }
+    } else {
+        // matches may end anywhere before the end of the line, where the run starts
+        sets[states[other].set] = (set_t) { { ~0ull, ~0ull, ~0ull, ~0ull, 0 } };
+        addSymbol(sets + states[other].set, eol);
+        states[other].out[0] = start;
+    }
+
+    // state 0 is dead, state 1 is the start state
+    numDfaStates = 0;
+    findDfaState(members, 0);
+    members[0] = start;
+    findDfaState(members, closure(members, 1));
+
+    for (int d = 1; d < numDfaStates; ++d) {
+        for (int sym = 0; sym < numSymbols; ++sym) {
+            int size = 0;
+
+            for (int i = 0; i < dfa[d].size; ++i) {
+                state_t * s = states + dfa[d].members[i];
+                if (s->type == symbolState && hasSymbol(sets + s->set, sym)) {
+                    members[size++] = s->out[0];
+                }
+            }
+
+            next[d][sym] = size ? findDfaState(members, closure(members, size)) : 0;
+        }
+    }
+
+    // symbols with identical columns share a class
+    int classes[numSymbols];
+    int numClasses = 0;
+
+    for (int sym = 0; sym < numSymbols; ++sym) {
+        classes[sym] = -1;
+
+        for (int other = 0; other < sym; ++other) {
+            int same = 1;
+            for (int d = 1; d < numDfaStates && same; ++d) {
+                same = next[d][sym] == next[d][other];
+            }
+
+            if (same) {
+                classes[sym] = classes[other];
+                break;
+            }
+        }
+
+        if (classes[sym] < 0) {
+            classes[sym] = numClasses++;
+        }
+    }
+
+    // libcaddy65 lowercases matched text without scanning it again
+    for (int c = 'a'; c <= 'z'; ++c) {
+        if (classes[c] != classes[toupper(c)]) {
+            fail("case sensitive matcher");
+        }
+    }
+
+    if (numClasses > 255) {
+        fail("too many sym classes");
+    }
+
+    ruleClasses[dir][rule] = numClasses;
+
+    const char * name = ruleNames[rule];
+    const char * suffix = directionNames[dir];
+
+    printf("static const unsigned char %s%sClasses[%d] = {", name, suffix, numSymbols);
+    for (int sym = 0; sym < numSymbols; ++sym) {
+        printf("%s%d,", sym % 16 ? " " : "\n    ", classes[sym]);
+    }
+    printf("\n};\n\n");
+
+    printf("static const unsigned short %s%sNext[%d] = {", name, suffix, numDfaStates * numClasses);
+    for (int d = 0; d < numDfaStates; ++d) {
+        printf("\n   ");
+        for (int c = 0; c < numClasses; ++c) {
+            int sym = 0;
+            while (classes[sym] != c) {
+                ++sym;
+            }
+            printf(" %d,", next[d][sym]);
+        }
+    }
+    printf("\n};\n\n");
+
+    printf("static const unsigned char %s%sAccept[%d] = {\n   ", name, suffix, numDfaStates);
+    for (int d = 0; d < numDfaStates; ++d) {
+        printf(" %d,", dfa[d].accept);
+    }
+    printf("\n};\n\n");
+
+    for (int d = 0; d < numDfaStates; ++d) {
+        free(dfa[d].members);
+    }
+}
+
+// must match hashName in libcaddy65.c
+static uint64_t hashName(const char * name, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t) name[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static void generateRuleSlots(void) {
+    int slots[ruleSlotCount];
+
+    for (int i = 0; i < ruleSlotCount; ++i) {
+        slots[i] = -1;
+    }
+
+    for (int i = 0; i < numRules; ++i) {
+        size_t slot = hashName(ruleNames[i], strlen(ruleNames[i])) & (ruleSlotCount - 1);
+
+        while (slots[slot] >= 0) {
+            slot = (slot + 1) & (ruleSlotCount - 1);
+        }
+
+        slots[slot] = i;
+    }
+
+    printf("#define ruleSlotCount %d\n\n", ruleSlotCount);
+    printf("static const signed char ruleSlots[ruleSlotCount] = {");
+    for (int i = 0; i < ruleSlotCount; ++i) {
+        printf("%s%d,", i % 16 ? " " : "\n    ", slots[i]);
+    }
+    printf("\n};\n\n");
+}
+
+static uint32_t readConfig(const char * path) {
+    FILE * config = fopen(path, "r");
+    uint32_t enabled = (1u << numRules) - 1;
+    char line[4096];
+
+    if (!config) {
+        fprintf(stderr, "rulegen: failed to open config file: %s\n", path);
+        exit(1);
+    }
+
+    // parsed the same way as caddy65Create, but unknown rules are errors
+    while (fgets(line, sizeof(line), config)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char * c = strchr(line, ':');
+        if (!c) {
+            fprintf(stderr, "rulegen: failed to read config: \"%s\"\n", line);
+            exit(1);
+        }
+
+        int enable = strstr(c, "enabled") ? 1 : 0;
+        int rule = 0;
+
+        *c = '\0';
+        while (rule < numRules && strcmp(ruleNames[rule], line)) {
+            ++rule;
+        }
+
+        if (rule == numRules) {
+            fprintf(stderr, "rulegen: unknown rule read from config file: \"%s\"\n", line);
+            exit(1);
+        }
+
+        if (enable) {
+            enabled |= 1u << rule;
+        } else {
+            enabled &= ~(1u << rule);
+        }
+    }
+
+    fclose(config);
+    return enabled;
+}
+
+static void generateSequence(uint32_t enabled) {
+    printf("#define enabledRules 0x%08xu\n\n", enabled);
+    printf("#define forEachEnabledRule(apply)");
+
+    for (int i = 0; i < numRules; ++i) {
+        if (enabled & (1u << i)) {
+            printf(" \\\n    apply(%s)", ruleNames[i]);
+        }
+    }
+
+    printf("\n\n");
+}
+
+int main(int argc, char ** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [caddy65.cfg]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t enabled = argc > 1 ? readConfig(argv[1]) : 0;
+
+    printf("/* generated by rulegen from the patterns in rules.h, which must be included first */\n\n");
+    printf("#ifndef MATCHERS_H\n#define MATCHERS_H\n\n");
+
+    for (int i = 0; i < numRules; ++i) {
+        generate(i, forwardMatcher);
+        generate(i, reverseMatcher);
+    }
+
+    for (int dir = forwardMatcher; dir <= reverseMatcher; ++dir) {
+        const char * suffix = directionNames[dir];
+
+        printf("static const matcher_t %c%sMatchers[numRules] = {\n", tolower(suffix[0]), suffix + 1);
+        for (int i = 0; i < numRules; ++i) {
+            printf("    { %s%sClasses, %s%sNext, %s%sAccept, %d },\n",
+                ruleNames[i], suffix, ruleNames[i], suffix, ruleNames[i], suffix, ruleClasses[dir][i]);
+        }
+        printf("};\n\n");
+    }
+
+    printf("#define anchoredRules 0x%08xu\n\n", anchoredRules);
+
+    generateRuleSlots();
+
+    if (argc > 1) {
+        generateSequence(enabled);
+    }
+
+    printf("#endif\n");
+
+    return 0;
+}
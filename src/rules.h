@@ -0,0 +1,147 @@
+#ifndef RULES_H
+#define RULES_H
+
+/*
+ * Rule patterns shared by libcaddy65 and the rulegen build step, which
+ * compiles each pattern into a C matcher (see matchers.h).
+ */
+
+#define spacing "([[:space:]]*)"
+#define comment spacing ";" spacing "(.?)"
+
+#define leadingSpace "^" spacing
+#define trailingSpace spacing "$"
+#define tab "(\t)"
+
+#define bitwise "^(and|eor|ora)"
+
+#define address "[^#][$]([[:xdigit:]]+)"
+#define hexLiteral "[#][$]([[:xdigit:]]+)"
+#define binaryLiteral "[#][%]([01]{1,8})"
+
+#define openParen spacing "[(]" spacing
+#define closeParen spacing "[)]" spacing
+#define comma spacing "," spacing
+
+#define operator "([-+*/&|^=<>\\]|"\
+                 "<<|>>|<>|<=|>=|&&|[|][|]|"\
+                 "[.](mod|bitand|bitor|bitxor|shl|shr|and|or|xor))"
+#define byteOperator spacing "([#][<>])" spacing
+
+#define argStart "([$%\"_[:alnum:]])"
+#define control "[.]([[:alpha:]][[:alnum:]]*)" spacing argStart "?"
+#define symbol "([_[:alpha:]]([_[:alnum:]]|(::))*)"
+#define macroDef "^[.]macro" spacing "([^[:space:]]+)(" spacing "([^,[:space:]]*))"
+#define macroUse "^" symbol "((([[:space:]]+)" argStart ")|$)"
+#define label "^([@_[:alpha:]][_[:alnum:]]*)" spacing ":" spacing "([^+-]|$)"
+#define unnamed "^:" spacing
+#define relative ":([+]+|[-]+)"
+#define index spacing "," spacing "([XYxy])"
+#define indirection "[(]" spacing "([^,)[:space:]]+)" spacing "[)]"
+#define indirectionX "[(]" spacing "([^,)[:space:]]+)" spacing "," spacing "([Xx])" spacing "[)]"
+#define indirectionY "[(]" spacing "([^,)[:space:]]+)" spacing "[)]" spacing "," spacing "([Yy])"
+#define instruction "^(adc|and|asl|bcc|bcs|beq|bit|bmi|bne|bpl|brk|bvc|bvs|clc|"\
+                      "cld|cli|clv|cmp|cpx|cpy|dec|dex|dey|eor|inc|inx|iny|jmp|"\
+                      "jsr|lda|ldx|ldy|lsr|nop|ora|pha|php|pla|plp|rol|ror|rti|"\
+                      "rts|sbc|sec|sed|sei|sta|stx|sty|tax|tay|tsx|txa|txs|tya)"
+
+
+typedef enum {
+    onlyComment,
+    trimLeading,
+    trimTrailing,
+    tabExpansion,
+    bitwiseInstruction,
+    addressFormatting,
+    hexLiteralFormatting,
+    binaryLiteralFormatting,
+    openParenSpacing,
+    closeParenSpacing,
+    operatorFormatting,
+    byteOperatorFormatting,
+    commaSpacing,
+    controlCommand,
+    macroDefinition,
+    macroInstance,
+    namedLabel,
+    unnamedLabel,
+    impliedInstruction,
+    immediateInstruction,
+    addressInstruction,
+    indexedInstruction,
+    indirectInstruction,
+    indirectXInstruction,
+    indirectYInstruction,
+    relativeInstruction,
+    commentSpacing,
+    numRules,
+} rule_t;
+
+static const char * ruleNames[numRules] = {
+    "onlyComment",
+    "trimLeading",
+    "trimTrailing",
+    "tabExpansion",
+    "bitwiseInstruction",
+    "addressFormatting",
+    "hexLiteralFormatting",
+    "binaryLiteralFormatting",
+    "openParenSpacing",
+    "closeParenSpacing",
+    "operatorFormatting",
+    "byteOperatorFormatting",
+    "commaSpacing",
+    "controlCommand",
+    "macroDefinition",
+    "macroInstance",
+    "namedLabel",
+    "unnamedLabel",
+    "impliedInstruction",
+    "immediateInstruction",
+    "addressInstruction",
+    "indexedInstruction",
+    "indirectInstruction",
+    "indirectXInstruction",
+    "indirectYInstruction",
+    "relativeInstruction",
+    "commentSpacing",
+};
+
+static const char * patterns[numRules] = {
+    "^" comment,
+    leadingSpace,
+    trailingSpace,
+    tab,
+    bitwise,
+    address,
+    hexLiteral,
+    binaryLiteral,
+    openParen,
+    closeParen,
+    "[^(#:+-]" spacing operator spacing "([^[:space:]]?)",
+    byteOperator,
+    comma,
+    control,
+    macroDef,
+    macroUse,
+    label,
+    unnamed,
+    instruction spacing "(;|$)",
+    instruction spacing "(#)",
+    instruction spacing "([$])",
+    instruction spacing "([^,[:space:]]+)" index,
+    instruction spacing indirection,
+    instruction spacing indirectionX,
+    instruction spacing indirectionY,
+    instruction spacing relative,
+    comment,
+};
+
+typedef struct {
+    const unsigned char * classes;
+    const unsigned short * next;
+    const unsigned char * accept;
+    int numClasses;
+} matcher_t;
+
+#endif
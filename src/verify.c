@@ -0,0 +1,505 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "verify.h"
+
+extern char ** environ;
+
+static const char * const sourceSuffix = ".caddy65.verify.s";
+static const char * const objectSuffix = ".caddy65.verify.o";
+static const char * const originalSuffix = ".caddy65.orig.o";
+
+#define objectMagic 0x616e7a55u
+#define objectHeaderSize 96
+
+// sections of a ca65 object, in the order of the header
+typedef enum {
+    optionSection,
+    fileSection,
+    segmentSection,
+    importSection,
+    exportSection,
+    debugSymbolSection,
+    lineInfoSection,
+    stringSection,
+    assertionSection,
+    scopeSection,
+    spanSection,
+    numSections,
+} section_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t hash;
+} cacheEntry_t;
+
+struct verifier {
+    const char * assembler;
+    const char * cachePath;
+    cacheEntry_t * entries;
+    size_t capacity;
+    size_t count;
+    int dirty;
+    int parallel;
+    pthread_mutex_t lock;
+};
+
+static uint64_t hashBytes(uint64_t hash, const void * data, size_t size) {
+    const uint8_t * c = data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= c[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t cacheKey(const char * path, const char * source, size_t size) {
+    uint64_t hash = hashBytes(14695981039346656037ull, path, strlen(path) + 1);
+
+    // zero marks empty slots
+    return hashBytes(hash, source, size) | 1;
+}
+
+static cacheEntry_t * findEntry(cacheEntry_t * entries, size_t capacity, uint64_t key) {
+    size_t i = key & (capacity - 1);
+
+    while (entries[i].key && entries[i].key != key) {
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return entries + i;
+}
+
+static int lookupHash(verifier_t * verifier, uint64_t key, uint64_t * hash) {
+    if (!verifier->capacity) {
+        return 0;
+    }
+
+    cacheEntry_t * entry = findEntry(verifier->entries, verifier->capacity, key);
+    *hash = entry->hash;
+    return entry->key != 0;
+}
+
+static int storeHash(verifier_t * verifier, uint64_t key, uint64_t hash) {
+    if ((verifier->count + 1) * 2 > verifier->capacity) {
+        size_t capacity = verifier->capacity ? verifier->capacity * 2 : 256;
+        cacheEntry_t * entries = calloc(capacity, sizeof(cacheEntry_t));
+        if (!entries) {
+            return 1;
+        }
+
+        for (size_t i = 0; i < verifier->capacity; ++i) {
+            if (verifier->entries[i].key) {
+                *findEntry(entries, capacity, verifier->entries[i].key) = verifier->entries[i];
+            }
+        }
+
+        free(verifier->entries);
+        verifier->entries = entries;
+        verifier->capacity = capacity;
+    }
+
+    cacheEntry_t * entry = findEntry(verifier->entries, verifier->capacity, key);
+    if (!entry->key) {
+        ++verifier->count;
+    }
+
+    entry->key = key;
+    entry->hash = hash;
+    verifier->dirty = 1;
+    return 0;
+}
+
+// adds the entries in the cache file, keeping those already known
+static void loadCache(verifier_t * verifier) {
+    FILE * cache = fopen(verifier->cachePath, "r");
+    if (!cache) {
+        return;
+    }
+
+    uint64_t key;
+    uint64_t hash;
+    uint64_t known;
+
+    while (fscanf(cache, "%" SCNx64 " %" SCNx64, &key, &hash) == 2) {
+        if (key && !lookupHash(verifier, key, &known) && storeHash(verifier, key, hash)) {
+            break;
+        }
+    }
+
+    fclose(cache);
+}
+
+/*
+ * Other runs may have saved entries since this one loaded the cache, so those
+ * are merged in first, holding a lock file so that runs finishing together
+ * take turns. The cache is written to a temporary file and renamed into
+ * place, so runs that are still loading it never read a partial cache.
+ */
+static int saveCache(verifier_t * verifier) {
+    char temp[4096];
+    char lock[4096];
+    int len = snprintf(temp, sizeof(temp), "%s.%ld.tmp", verifier->cachePath, (long) getpid());
+    int lockLen = snprintf(lock, sizeof(lock), "%s.lock", verifier->cachePath);
+
+    if (len < 0 || (size_t) len >= sizeof(temp) || lockLen < 0 || (size_t) lockLen >= sizeof(lock)) {
+        return 1;
+    }
+
+    // without the lock, entries saved by a concurrent run may be lost, but the cache stays whole
+    int lockFd = open(lock, O_RDWR | O_CREAT, 0666);
+    if (lockFd >= 0) {
+        while (flock(lockFd, LOCK_EX) && errno == EINTR) {
+        }
+    }
+
+    loadCache(verifier);
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    FILE * cache = fd < 0 ? NULL : fdopen(fd, "w");
+    int failed = !cache;
+
+    if (fd >= 0 && !cache) {
+        close(fd);
+    }
+
+    for (size_t i = 0; cache && i < verifier->capacity; ++i) {
+        if (verifier->entries[i].key) {
+            fprintf(cache, "%016" PRIx64 " %016" PRIx64 "\n", verifier->entries[i].key, verifier->entries[i].hash);
+        }
+    }
+
+    if (cache && fclose(cache)) {
+        failed = 1;
+    }
+
+    if (!failed && rename(temp, verifier->cachePath)) {
+        failed = 1;
+    }
+
+    if (failed && fd >= 0) {
+        unlink(temp);
+    }
+
+    if (lockFd >= 0) {
+        close(lockFd);
+    }
+
+    return failed;
+}
+
+verifier_t * verifierCreate(const char * assembler, const char * cachePath, int parallel) {
+    verifier_t * verifier = calloc(1, sizeof(verifier_t));
+    if (!verifier) {
+        return NULL;
+    }
+
+    verifier->assembler = assembler;
+    verifier->cachePath = cachePath;
+    verifier->parallel = parallel;
+    pthread_mutex_init(&verifier->lock, NULL);
+
+    if (cachePath) {
+        loadCache(verifier);
+        verifier->dirty = 0;
+    }
+
+    return verifier;
+}
+
+int verifierFree(verifier_t * verifier) {
+    if (!verifier) {
+        return 0;
+    }
+
+    int failed = 0;
+
+    if (verifier->dirty && saveCache(verifier)) {
+        fprintf(stderr, "failed to write verification cache: %s\n", verifier->cachePath);
+        failed = 1;
+    }
+
+    pthread_mutex_destroy(&verifier->lock);
+    free(verifier->entries);
+    free(verifier);
+    return failed;
+}
+
+static char * withSuffix(const char * path, const char * suffix) {
+    size_t len = strlen(path);
+    size_t suffixLen = strlen(suffix);
+    char * name = malloc(len + suffixLen + 1);
+
+    if (name) {
+        memcpy(name, path, len);
+        memcpy(name + len, suffix, suffixLen + 1);
+    }
+
+    return name;
+}
+
+static int writeSource(const char * path, const char * source, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 1;
+    }
+
+    while (size) {
+        ssize_t written = write(fd, source, size);
+
+        if (written < 0 && errno != EINTR) {
+            close(fd);
+            return 1;
+        }
+
+        if (written > 0) {
+            source += written;
+            size -= written;
+        }
+    }
+
+    return close(fd) != 0;
+}
+
+static uint8_t * readObject(const char * path, size_t * size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    uint8_t * object = fstat(fd, &st) ? NULL : malloc(st.st_size + 1);
+    size_t done = 0;
+
+    while (object && done < (size_t) st.st_size) {
+        ssize_t len = read(fd, object + done, st.st_size - done);
+
+        if (len <= 0 && !(len < 0 && errno == EINTR)) {
+            free(object);
+            object = NULL;
+        } else if (len > 0) {
+            done += len;
+        }
+    }
+
+    close(fd);
+    *size = done;
+    return object;
+}
+
+static uint32_t read32(const uint8_t * c) {
+    return c[0] | c[1] << 8 | c[2] << 16 | (uint32_t) c[3] << 24;
+}
+
+static int readVar(const uint8_t ** c, const uint8_t * end, uint32_t * value) {
+    uint32_t v = 0;
+    int shift = 0;
+
+    do {
+        if (*c >= end || shift > 28) {
+            return 1;
+        }
+
+        v |= (uint32_t) (**c & 0x7f) << shift;
+        shift += 7;
+    } while (*(*c)++ & 0x80);
+
+    *value = v;
+    return 0;
+}
+
+static int hashStrings(uint64_t * hash, const uint8_t * c, size_t size, const char * sourceName) {
+    const uint8_t * end = c + size;
+    size_t nameLen = strlen(sourceName);
+    uint32_t count;
+
+    if (readVar(&c, end, &count)) {
+        return 1;
+    }
+
+    *hash = hashBytes(*hash, &count, sizeof(count));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t len;
+
+        if (readVar(&c, end, &len) || len > (size_t) (end - c)) {
+            return 1;
+        }
+
+        // the two assemblies read the source under different names
+        if (len == nameLen && memcmp(c, sourceName, len) == 0) {
+            *hash = hashBytes(*hash, "", 1);
+        } else {
+            *hash = hashBytes(*hash, &len, sizeof(len));
+            *hash = hashBytes(*hash, c, len);
+        }
+
+        c += len;
+    }
+
+    return 0;
+}
+
+// hashes the parts of an object that do not depend on the source's name, size, or line numbers
+static int hashObject(const char * path, const char * sourceName, uint64_t * hash) {
+    size_t size;
+    uint8_t * object = readObject(path, &size);
+
+    if (!object) {
+        return 1;
+    }
+
+    int failed = size < objectHeaderSize || read32(object) != objectMagic;
+    uint64_t h = hashBytes(14695981039346656037ull, object + 4, 2);
+
+    for (int i = 0; !failed && i < numSections; ++i) {
+        uint32_t offset = read32(object + 8 + i * 8);
+        uint32_t len = read32(object + 12 + i * 8);
+
+        if (offset > size || len > size - offset) {
+            failed = 1;
+            break;
+        }
+
+        switch (i) {
+            case optionSection:
+            case fileSection:
+            case lineInfoSection: {
+                break;
+            }
+            case stringSection: {
+                failed = hashStrings(&h, object + offset, len, sourceName);
+                break;
+            }
+            default: {
+                h = hashBytes(h, object + offset, len);
+                break;
+            }
+        }
+    }
+
+    free(object);
+    *hash = h;
+    return failed;
+}
+
+static int spawnAssembler(verifier_t * verifier, const char * source, const char * object, pid_t * pid) {
+    char * argv[] = { (char *) verifier->assembler, (char *) source, "-o", (char *) object, NULL };
+    int error = posix_spawnp(pid, verifier->assembler, NULL, NULL, argv, environ);
+
+    if (error) {
+        fprintf(stderr, "failed to run %s: %s\n", verifier->assembler, strerror(error));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int waitAssembler(pid_t pid) {
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+// waits for an assembly and hashes its object, returning nonzero on failure
+static int collectAssembler(pid_t pid, const char * source, const char * object, uint64_t * hash) {
+    int failed = 0;
+
+    if (waitAssembler(pid)) {
+        fprintf(stderr, "failed to assemble %s\n", source);
+        failed = 1;
+    } else if (hashObject(object, source, hash)) {
+        fprintf(stderr, "failed to read object %s\n", object);
+        failed = 1;
+    }
+
+    unlink(object);
+    return failed;
+}
+
+int verifySource(verifier_t * verifier, const char * path, const char * input, size_t inputSize,
+    const char * output, size_t outputSize) {
+
+    uint64_t keys[2] = { cacheKey(path, input, inputSize), cacheKey(path, output, outputSize) };
+    uint64_t hashes[2];
+    int cached[2];
+
+    pthread_mutex_lock(&verifier->lock);
+    cached[0] = lookupHash(verifier, keys[0], hashes + 0);
+    cached[1] = lookupHash(verifier, keys[1], hashes + 1);
+    pthread_mutex_unlock(&verifier->lock);
+
+    char * sources[2] = { (char *) path, withSuffix(path, sourceSuffix) };
+    char * objects[2] = { withSuffix(path, originalSuffix), withSuffix(path, objectSuffix) };
+    pid_t pids[2];
+    int spawned[2] = { 0, 0 };
+    int failed = !sources[1] || !objects[0] || !objects[1];
+
+    if (!failed && !cached[1] && writeSource(sources[1], output, outputSize)) {
+        fprintf(stderr, "failed to write %s: %s\n", sources[1], strerror(errno));
+        failed = 1;
+    }
+
+    // without a job slot for each, the assemblies take turns
+    for (int i = 0; !failed && i < 2; ++i) {
+        if (!cached[i]) {
+            failed = spawnAssembler(verifier, sources[i], objects[i], pids + i);
+            spawned[i] = !failed;
+        }
+
+        if (spawned[i] && !verifier->parallel) {
+            failed = collectAssembler(pids[i], sources[i], objects[i], hashes + i);
+            spawned[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (spawned[i] && collectAssembler(pids[i], sources[i], objects[i], hashes + i)) {
+            failed = 1;
+        }
+    }
+
+    if (sources[1] && !cached[1]) {
+        unlink(sources[1]);
+    }
+
+    if (!failed && verifier->cachePath) {
+        pthread_mutex_lock(&verifier->lock);
+        for (int i = 0; i < 2; ++i) {
+            if (!cached[i]) {
+                storeHash(verifier, keys[i], hashes[i]);
+            }
+        }
+        pthread_mutex_unlock(&verifier->lock);
+    }
+
+    if (!failed && hashes[0] != hashes[1]) {
+        fprintf(stderr, "formatting changes the assembled object: %s\n", path);
+        failed = 1;
+    }
+
+    free(sources[1]);
+    free(objects[0]);
+    free(objects[1]);
+    return failed;
+}
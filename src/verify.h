@@ -0,0 +1,41 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stddef.h>
+
+/*
+ * Assembler equivalence checks for the caddy65 command line tool.
+ *
+ * A source file and its formatted replacement are assembled side by side
+ * with ca65, and their objects are compared, ignoring the parts that record
+ * the source file itself, such as its name, size, and line numbers.
+ *
+ * Object hashes are cached by source path and contents, so sources that
+ * have not changed since a previous run are not assembled again. The cache
+ * does not track included files.
+ */
+
+typedef struct verifier verifier_t;
+
+/*
+ * Creates a verifier that runs the given assembler, loading the cache file
+ * if it exists. A NULL cachePath disables caching. Unless parallel is set,
+ * the two assemblies for a file run one after the other.
+ */
+verifier_t * verifierCreate(const char * assembler, const char * cachePath, int parallel);
+
+/*
+ * Saves the cache, if it changed, merged with entries other runs have saved
+ * since it was loaded, and releases the verifier.
+ * Returns nonzero if the cache could not be written.
+ */
+int verifierFree(verifier_t * verifier);
+
+/*
+ * Returns zero if output assembles to the same object as the source at path,
+ * whose contents are input. May be called from several threads at once.
+ */
+int verifySource(verifier_t * verifier, const char * path, const char * input, size_t inputSize,
+    const char * output, size_t outputSize);
+
+#endif
@@ -0,0 +1 @@
+  .byte #%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1,#%1
@@ -0,0 +1 @@
+  .byte #$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F,#$00F
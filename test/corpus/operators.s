@@ -0,0 +1 @@
+  lda #a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b+a .SHL b
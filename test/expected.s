@@ -63,6 +63,17 @@
   swap $00, $01
   xor #$42
 
+; macros from includes and unofficial opcodes
+.include "macros.inc"
+  mymac $10
+.setcpu "6502X"
+  lax $10
+.setcpu "65C02"
+loop:
+  bra loop
+  stz $10
+.setcpu "6502"
+
 ; named labels
 bar:
 baz:
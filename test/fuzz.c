@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/caddy65.h"
+
+/*
+ * libFuzzer target for libcaddy65.
+ *
+ * Aborts when formatting is not idempotent, with or without an index of the
+ * input's macros, when rule-major blocks disagree
+ * with line-by-line formatting, or when the time spent on a single line grows
+ * faster than linearly as its longest run of a repeated byte is stretched.
+ * Hangs are caught by the libFuzzer -timeout option.
+ *
+ * Building with -DCADDY65_FUZZ_STANDALONE produces a driver that replays and
+ * times the files passed on the command line, which is used to benchmark the
+ * corpus without a libFuzzer toolchain.
+ */
+
+#define shortLine 256
+#define longLine 2048
+#define numLengths 4
+#define noiseFloor 100e-6
+#define slack 2
+
+static caddy65_t * ctx;
+static caddy65_t * blocks;
+static caddy65_t * indexed;
+static int failures;
+static char output[3][16384];
+static char line[longLine + 1];
+
+static void fail(void) {
+#ifdef CADDY65_FUZZ_STANDALONE
+    ++failures;
+#else
+    abort();
+#endif
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int format(const char * input, size_t inputSize, char * out, size_t * outLength) {
+    return caddy65FormatBuffer(ctx, input, inputSize, out, sizeof(output[0]), outLength) == caddy65Success;
+}
+
+// indexes the input's own macros first, as caddy65 -m does for each file
+static int formatIndexed(const char * input, size_t inputSize, char * out, size_t * outLength) {
+    caddy65_macros_t * macros = caddy65MacrosCreate();
+    if (!macros || caddy65MacrosScan(macros, input, inputSize, NULL, NULL) != caddy65Success) {
+        abort();
+    }
+
+    caddy65UseMacros(indexed, macros);
+    caddy65_status_t status = caddy65FormatBuffer(indexed, input, inputSize, out, sizeof(output[0]), outLength);
+    caddy65UseMacros(indexed, NULL);
+    caddy65MacrosFree(macros);
+
+    return status == caddy65Success;
+}
+
+static double timeLine(size_t length) {
+    double best = 1e9;
+
+    for (int i = 0; i < 5; ++i) {
+        size_t written;
+        caddy65Reset(ctx);
+
+        double start = now();
+        caddy65_status_t status = caddy65FormatLine(ctx, line, length, output[2], sizeof(output[2]), &written);
+        double elapsed = now() - start;
+
+        if (status != caddy65Success) {
+            return -1;
+        }
+
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return best;
+}
+
+// stretches the longest run of a repeated byte, so whatever follows it stays in the line
+static void stretchLine(const uint8_t * data, size_t size, size_t run, size_t runLength, size_t length) {
+    size_t other = size - runLength;
+    size_t stretched = length - other;
+
+    memcpy(line, data, run);
+    memset(line + run, data[run], stretched);
+    memcpy(line + run + stretched, data + run + runLength, size - run - runLength);
+}
+
+static void checkScaling(const uint8_t * data, size_t size) {
+    size_t len = 0;
+    while (len < size && data[len] != '\n' && data[len] != '\0') {
+        ++len;
+    }
+
+    size_t run = 0;
+    size_t runLength = 0;
+
+    for (size_t i = 0, j; i < len; i = j) {
+        for (j = i + 1; j < len && data[j] == data[i]; ++j) {
+        }
+
+        if (j - i > runLength) {
+            run = i;
+            runLength = j - i;
+        }
+    }
+
+    if (!runLength) {
+        return;
+    }
+
+    size_t lengths[numLengths];
+    double times[numLengths];
+    int timed = 0;
+
+    for (size_t length = shortLine; length <= longLine; length *= 2) {
+        if (len - runLength >= length) {
+            continue;
+        }
+
+        stretchLine(data, len, run, runLength, length);
+
+        double elapsed = timeLine(length);
+        if (elapsed < 0) {
+            return;
+        }
+
+        lengths[timed] = length;
+        times[timed++] = elapsed;
+    }
+
+    if (timed < 3 || times[timed - 1] < noiseFloor) {
+        return;
+    }
+
+    for (int i = 1; i < timed; ++i) {
+        double linear = times[0] * lengths[i] / lengths[0];
+
+        if (times[i] > linear * slack) {
+            fprintf(stderr, "superlinear line time: %zu bytes in %.0fus, %zu bytes in %.0fus\n",
+                lengths[0], times[0] * 1e6, lengths[i], times[i] * 1e6);
+            fail();
+            return;
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    if (!ctx) {
+        ctx = caddy65Create(NULL);
+        blocks = caddy65Create(NULL);
+        indexed = caddy65Create(NULL);
+        if (!ctx || !blocks || !indexed || caddy65UseBlocks(blocks, 1) != caddy65Success) {
+            abort();
+        }
+    }
+
+    if (size > 2048 || memchr(data, '\0', size)) {
+        return 0;
+    }
+
+    size_t once;
+    size_t twice;
+
+    if (!format((const char *) data, size, output[0], &once)) {
+        return 0;
+    }
+
+    if (!format(output[0], once, output[1], &twice)) {
+        fprintf(stderr, "formatted output was rejected:\n%s\n", output[0]);
+        fail();
+        return 0;
+    }
+
+    if (once != twice || memcmp(output[0], output[1], once)) {
+        fprintf(stderr, "formatting is not idempotent:\n%s\n---\n%s\n", output[0], output[1]);
+        fail();
+    }
+
+    if (caddy65FormatBuffer(blocks, (const char *) data, size, output[1], sizeof(output[1]), &twice) != caddy65Success ||
+        once != twice || memcmp(output[0], output[1], once)) {
+
+        fprintf(stderr, "rule-major blocks differ:\n%s\n---\n%s\n", output[0], output[1]);
+        fail();
+    }
+
+    if (formatIndexed((const char *) data, size, output[0], &once)) {
+        if (!formatIndexed(output[0], once, output[1], &twice)) {
+            fprintf(stderr, "output formatted with a macro index was rejected:\n%s\n", output[0]);
+            fail();
+        } else if (once != twice || memcmp(output[0], output[1], once)) {
+            fprintf(stderr, "formatting with a macro index is not idempotent:\n%s\n---\n%s\n", output[0], output[1]);
+            fail();
+        }
+    }
+
+    checkScaling(data, size);
+    return 0;
+}
+
+#ifdef CADDY65_FUZZ_STANDALONE
+int main(int argc, char ** argv) {
+    static uint8_t data[2049];
+    int status = 0;
+    int failed = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        FILE * file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "failed to open %s\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+
+        double start = now();
+        LLVMFuzzerTestOneInput(data, size);
+        printf("%8.0fus %s%s\n", (now() - start) * 1e6, argv[i], failures != failed ? " (failed)" : "");
+        failed = failures;
+    }
+
+    return status || failures;
+}
+#endif
@@ -0,0 +1,95 @@
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Startup benchmark for the caddy65 command line tool.
+ *
+ * Runs the given command repeatedly and times each run from exec to the
+ * first byte written to stdout, so the command should always print something,
+ * for example with -s. caddy65 prints its statistics only once it finishes,
+ * and stdout is a pipe here, so this measures the whole run; give it a one
+ * line input to see startup alone.
+ */
+
+#define numRuns 100
+
+extern char ** environ;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compareTimes(const void * a, const void * b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double timeRun(char ** argv) {
+    int fds[2];
+    if (pipe(fds)) {
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    pid_t pid;
+    double start = now();
+    int status = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    double elapsed = -1;
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (!status) {
+        char buffer[4096];
+        ssize_t len = read(fds[0], buffer, sizeof(buffer));
+
+        if (len > 0) {
+            elapsed = now() - start;
+        }
+
+        // drain the rest so the child never blocks on a full pipe
+        while (len > 0) {
+            len = read(fds[0], buffer, sizeof(buffer));
+        }
+
+        waitpid(pid, NULL, 0);
+    }
+
+    close(fds[0]);
+    return elapsed;
+}
+
+int main(int argc, char ** argv) {
+    static double times[numRuns];
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <command> [args]...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < numRuns; ++i) {
+        times[i] = timeRun(argv + 1);
+
+        if (times[i] < 0) {
+            fprintf(stderr, "failed to read output from %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    qsort(times, numRuns, sizeof(double), compareTimes);
+    printf("exec to first output byte: %.0fus median, %.0fus min, %.0fus max over %d runs\n",
+        times[numRuns / 2] * 1e6, times[0] * 1e6, times[numRuns - 1] * 1e6, numRuns);
+    return 0;
+}
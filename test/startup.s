@@ -0,0 +1 @@
+  lda    #$00